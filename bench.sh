@@ -0,0 +1,406 @@
+#!/bin/bash
+
+# Offline regression benchmark: runs the bench_corpus.txt parameter sets
+# through the generator and the trace tools over a synthetic sample trace,
+# checks the outputs against bench_golden.txt and prints one JSON line of
+# wall time, throughput and peak RSS per stage.
+#
+# Run it with "make bench", or by hand from the build directory:
+#	BUILDDIR=. ./bench.sh
+#
+# BENCH_UPDATE=1 rewrites the goldens instead of checking them,
+# BENCH_RESULTS sets the results file (default $BUILDDIR/bench_results.json),
+# BENCH_KEEP=1 keeps the work directory.
+
+export LC_ALL=C
+
+SRCDIR=$(cd "$(dirname "$0")" && pwd)
+BUILDDIR=$(cd "${BUILDDIR:-.}" && pwd)
+CORPUS="$SRCDIR/bench_corpus.txt"
+GOLDEN="$SRCDIR/bench_golden.txt"
+RESULTS="${BENCH_RESULTS:-$BUILDDIR/bench_results.json}"
+THREADS=$(nproc)
+STREAM_SLICES=20000
+TRACE_FRAMES=300
+TRACE_CHUNK=4096	# records, the index block size
+# One change of every parameter the slices depend on, see patch_h264()
+DEP_BASE="--SPS_profile_idc=100 --SPS_max_num_ref_frames=3
+	  --PPS_num_ref_idx_l0_default_active_minus1=2
+	  --PPS_num_ref_idx_l1_default_active_minus1=1
+	  --SPS_pic_width_in_mbs=20 --SPS_pic_height_in_map_units=4
+	  --SPS_frame_mbs_only_flag=0
+	  --SPS_pic_order_cnt_type=0 --SPS_log2_max_pic_order_cnt_lsb_minus4=2
+	  --PPS_transform_8x8_mode_flag=1 --INTER_skip_ratio=25 --INTER_mvd_range=32
+	  --slice slice_type=2,is_idr=1
+	  --slice slice_type=0,frame_num=1,pic_order_cnt_lsb=2
+	  --slice slice_type=1,frame_num=2,pic_order_cnt_lsb=4"
+DEP_VARIANTS=("--SPS_log2_max_frame_num_minus4=5"
+	      "--SPS_pic_order_cnt_type=2"
+	      "--SPS_log2_max_pic_order_cnt_lsb_minus4=6"
+	      "--SPS_pic_width_in_mbs=21"
+	      "--SPS_pic_height_in_map_units=5"
+	      "--SPS_frame_mbs_only_flag=1"
+	      "--SPS_mb_adaptive_frame_field_flag=1"
+	      "--SPS_direct_8x8_inference_flag=1"
+	      "--PPS_entropy_coding_mode_flag=1"
+	      "--PPS_deblocking_filter_control_present_flag=0"
+	      "--PPS_num_ref_idx_l0_default_active_minus1=0"
+	      "--PPS_num_ref_idx_l1_default_active_minus1=0"
+	      "--PPS_transform_8x8_mode_flag=0"
+	      "--REF_IDC=2"
+	      "--INTER_seed=7"
+	      "--INTER_skip_ratio=60"
+	      "--INTER_mvd_range=4")
+TRACE_FILTERS=("engine=MBE" "src=cpu type=WRITE32" "addr=0x6001A004 value=1"
+	       "frame=100-149" "frame=7 engine=BSEV,SXE")
+
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/vde_bench.XXXXXX") || exit $?
+SUMS="$WORK/sums.txt"
+FAILED=0
+
+cleanup() {
+	[ -n "$BENCH_KEEP" ] && echo "work directory $WORK" >&2 && return
+	rm -rf "$WORK"
+}
+
+trap cleanup EXIT
+
+fail() {
+	echo "FAIL: $*" >&2
+	((FAILED++))
+}
+
+checksum() {
+	echo "$(sha256sum < "$2" | cut -d' ' -f1)  $1" >> "$SUMS"
+}
+
+# Checksum of a directory contents, names included
+checksum_dir() {
+	(cd "$2" && sha256sum $(ls | sort)) > "$WORK/dir.sum"
+	checksum "$1" "$WORK/dir.sum"
+}
+
+file_size() {
+	stat -c %s "$@" 2> /dev/null | awk '{ sum += $1 } END { print sum + 0 }'
+}
+
+trace_records() {
+	echo $((($(file_size "$1") - 4) / 13))
+}
+
+# Runs the script under bench_exec, report_stage prints its results
+run_stage() {
+	"$BUILDDIR/bench_exec" -o "$WORK/$1.res" \
+		bash -e "$2" > "$WORK/$1.log" 2>&1
+}
+
+# report_stage <name> [<counter> <value>]...
+#
+# Prints the stage JSON line, every counter gets its per second rate
+# along, "bytes" gets MB/s. Fails if the stage did.
+report_stage() {
+	local name="$1"
+	local wall maxrss status json rate
+
+	shift
+
+	read -r wall maxrss status < "$WORK/$name.res" || {
+		fail "$name: no result"
+		return 1
+	}
+
+	json="{\"stage\":\"$name\",\"wall_s\":$wall,\"maxrss_kb\":$maxrss"
+	json+=",\"status\":$status"
+
+	while [ $# -gt 1 ]; do
+		rate=$(awk -v n="$2" -v t="$wall" -v b="$1" 'BEGIN {
+			if (b == "bytes")
+				n /= 1024 * 1024
+			printf "%.3f", (t > 0) ? n / t : 0
+		}')
+		if [ "$1" == "bytes" ]; then
+			json+=",\"bytes\":$2,\"mb_per_s\":$rate"
+		else
+			json+=",\"$1\":$2,\"$1_per_s\":$rate"
+		fi
+		shift 2
+	done
+
+	echo "$json}" | tee -a "$RESULTS"
+
+	if [ "$status" != "0" ]; then
+		fail "$name exited with $status, see below"
+		tail -n 20 "$WORK/$name.log" >&2
+		return 1
+	fi
+}
+
+# split.pl, with a stand-in for File::Slurp when it isn't installed
+split_pl() {
+	if ! perl -MFile::Slurp -e 1 2> /dev/null; then
+		mkdir -p "$WORK/perl/File"
+		cat > "$WORK/perl/File/Slurp.pm" <<-'EOF'
+		package File::Slurp;
+		use Exporter 'import';
+		our @EXPORT = qw(read_file write_file);
+		sub read_file {
+			open(my $fh, '<', $_[0]) or die "$_[0]: $!\n";
+			local $/;
+			return <$fh>;
+		}
+		sub write_file {
+			open(my $fh, '>', $_[0]) or die "$_[0]: $!\n";
+			print $fh $_[1];
+			close($fh) or die "$_[0]: $!\n";
+		}
+		1;
+		EOF
+	fi
+
+	perl -I"$WORK/perl" "$SRCDIR/split.pl" "$@"
+}
+
+corpus() {
+	grep -v -e '^#' -e '^[[:space:]]*$' "$CORPUS"
+}
+
+# Patching must regenerate the slices when a parameter they read changes
+bench_generator_deps() {
+	local i gen="$BUILDDIR/h264_test_generator" dir="$WORK/deps"
+
+	mkdir -p "$dir/base"
+
+	"$gen" -o "$dir/base.h264" -d "$dir/base" -t "$dir/base.tpl" \
+		$DEP_BASE > /dev/null || {
+		fail "dependencies template generation"
+		return
+	}
+
+	for i in "${!DEP_VARIANTS[@]}"; do
+		mkdir -p "$dir/full$i" "$dir/patch$i"
+
+		"$gen" -o "$dir/full$i.h264" -d "$dir/full$i" \
+			$DEP_BASE ${DEP_VARIANTS[$i]} > /dev/null &&
+		"$gen" -o "$dir/patch$i.h264" -d "$dir/patch$i" \
+			-p "$dir/base.tpl" $DEP_BASE ${DEP_VARIANTS[$i]} > /dev/null &&
+		diff -r "$dir/full$i" "$dir/patch$i" > /dev/null &&
+		cmp -s "$dir/full$i.h264" "$dir/patch$i.h264" ||
+		fail "patched ${DEP_VARIANTS[$i]} differs from the full one"
+	done
+}
+
+bench_generator() {
+	local name params streams=0 variant
+
+	mkdir -p "$WORK/gen" "$WORK/var" "$WORK/patch"
+
+	: > "$WORK/gen.sh"
+	while IFS=$'\t' read -r name params; do
+		mkdir -p "$WORK/gen/$name"
+		echo "'$BUILDDIR/h264_test_generator' -o '$WORK/gen/$name.h264'" \
+		     "-d '$WORK/gen/$name' $params > /dev/null" >> "$WORK/gen.sh"
+		((streams++))
+	done < <(corpus)
+
+	run_stage generate "$WORK/gen.sh"
+	report_stage generate streams $streams \
+		bytes $(file_size "$WORK/gen/"*.h264) || return
+
+	while IFS=$'\t' read -r name params; do
+		checksum "gen/$name" "$WORK/gen/$name.h264"
+		checksum_dir "gen/$name/data" "$WORK/gen/$name"
+	done < <(corpus)
+
+	# Variants of the last corpus entry, full and patched on a template
+	params=$(corpus | tail -n 1 | cut -f2)
+	: > "$WORK/var.sh"
+	: > "$WORK/patch.sh"
+
+	"$BUILDDIR/h264_test_generator" -o "$WORK/base.h264" -d "$WORK/patch" \
+		-t "$WORK/base.tpl" $params > /dev/null || {
+		fail "template generation"
+		return
+	}
+
+	for variant in $(seq -25 25); do
+		mkdir -p "$WORK/var/$variant" "$WORK/patch/$variant"
+		echo "'$BUILDDIR/h264_test_generator' -o '$WORK/var/$variant.h264'" \
+		     "-d '$WORK/var/$variant' $params" \
+		     "--PPS_pic_init_qp_minus26=$variant > /dev/null" >> "$WORK/var.sh"
+		echo "'$BUILDDIR/h264_test_generator' -o '$WORK/patch/$variant.h264'" \
+		     "-d '$WORK/patch/$variant' -p '$WORK/base.tpl' $params" \
+		     "--PPS_pic_init_qp_minus26=$variant > /dev/null" >> "$WORK/patch.sh"
+	done
+
+	run_stage generate_variants "$WORK/var.sh"
+	report_stage generate_variants streams 51 \
+		bytes $(file_size "$WORK/var/"*.h264)
+	run_stage generate_patch "$WORK/patch.sh"
+	report_stage generate_patch streams 51 \
+		bytes $(file_size "$WORK/patch/"*.h264) || return
+
+	for variant in $(seq -25 25); do
+		diff -r "$WORK/var/$variant" "$WORK/patch/$variant" > /dev/null &&
+		cmp -s "$WORK/var/$variant.h264" "$WORK/patch/$variant.h264" ||
+		fail "patched variant $variant differs from the full one"
+	done
+
+	bench_generator_deps
+
+	# Many slices in the bounded-memory streaming mode
+	awk -v n=$STREAM_SLICES 'BEGIN {
+		print "slice_type=7,is_idr=1,macroblocks_nb=99"
+		for (i = 1; i < n; i++)
+			printf "slice_type=5,frame_num=%d,pic_order_cnt_lsb=%d," \
+			       "macroblocks_nb=99\n", i % 256, (i * 2) % 1024
+	}' > "$WORK/slices.txt"
+
+	mkdir -p "$WORK/stream"
+	echo "'$BUILDDIR/h264_test_generator' -o '$WORK/stream.h264'" \
+	     "-d '$WORK/stream' -s -S '$WORK/slices.txt'" \
+	     "--SPS_pic_width_in_mbs=11 --SPS_pic_height_in_map_units=9" \
+	     "--SPS_log2_max_frame_num_minus4=4 > /dev/null" > "$WORK/stream.sh"
+
+	run_stage generate_stream "$WORK/stream.sh"
+	report_stage generate_stream slices $STREAM_SLICES \
+		bytes $(file_size "$WORK/stream.h264") || return
+
+	checksum "gen_stream" "$WORK/stream.h264"
+	checksum_dir "gen_stream/data" "$WORK/stream"
+}
+
+bench_traces() {
+	local trace="$WORK/sample.bin" records filter i=0
+
+	echo "perl '$SRCDIR/mk_sample_trace.pl' '$trace' $TRACE_FRAMES" > "$WORK/mk.sh"
+	run_stage trace_sample "$WORK/mk.sh"
+	records=$(trace_records "$trace")
+	report_stage trace_sample records $records \
+		bytes $(file_size "$trace") || return
+
+	checksum "trace/sample.bin" "$trace"
+
+	# Small chunks, most of their borders split a MEMSET32 run
+	echo "'$BUILDDIR/trace_to_txt' -j 1 -c $TRACE_CHUNK -i '$WORK/1.idx'" \
+	     "'$trace' '$WORK/1.txt'" > "$WORK/txt1.sh"
+	echo "'$BUILDDIR/trace_to_txt' -j $THREADS -c $TRACE_CHUNK" \
+	     "-i '$WORK/n.idx' '$trace' '$WORK/n.txt'" > "$WORK/txtn.sh"
+
+	run_stage trace_to_txt "$WORK/txt1.sh"
+	report_stage trace_to_txt records $records \
+		bytes $(file_size "$trace") || return
+	run_stage trace_to_txt_parallel "$WORK/txtn.sh"
+	report_stage trace_to_txt_parallel records $records \
+		bytes $(file_size "$trace") || return
+
+	checksum "trace/sample.txt" "$WORK/1.txt"
+	cmp -s "$WORK/1.txt" "$WORK/n.txt" ||
+		fail "trace_to_txt -j $THREADS output differs from -j 1"
+	cmp -s "$WORK/1.idx" "$WORK/n.idx" ||
+		fail "trace_to_txt -j $THREADS index differs from -j 1"
+
+	# Chunks shorter than the runs, whole chunks get merged into one
+	"$BUILDDIR/trace_to_txt" -j $THREADS -c 97 "$trace" "$WORK/97.txt" &&
+	cmp -s "$WORK/1.txt" "$WORK/97.txt" ||
+		fail "trace_to_txt -c 97 output differs from -c $TRACE_CHUNK"
+
+	echo "'$BUILDDIR/trace_heatmap' '$trace' > '$WORK/heatmap.txt'" \
+		> "$WORK/heatmap.sh"
+	run_stage trace_heatmap "$WORK/heatmap.sh"
+	report_stage trace_heatmap records $records || return
+	checksum "trace/heatmap" "$WORK/heatmap.txt"
+
+	# The trace coming through a pipe, as while it is being recorded
+	mkdir -p "$WORK/live" "$WORK/split"
+	echo "'$BUILDDIR/trace_live' -o '$WORK/live.txt' -f '$WORK/live' -" \
+	     "< '$trace' > /dev/null" > "$WORK/live.sh"
+	run_stage trace_live "$WORK/live.sh"
+	report_stage trace_live records $records \
+		bytes $(file_size "$trace") || return
+
+	cmp -s "$WORK/1.txt" "$WORK/live.txt" ||
+		fail "trace_live output differs from trace_to_txt"
+
+	cp "$WORK/1.txt" "$WORK/split/sample.txt"
+	split_pl "$WORK/split/sample.txt" &&
+	diff -r "$WORK/split/split_sample.txt" "$WORK/live" > /dev/null ||
+		fail "trace_live frames differ from split.pl ones"
+
+	cat "$trace" | "$BUILDDIR/trace_heatmap" - > "$WORK/heatmap_live.txt" &&
+	cmp -s "$WORK/heatmap.txt" "$WORK/heatmap_live.txt" ||
+		fail "trace_heatmap output differs when reading a pipe"
+
+	echo "'$BUILDDIR/trace_archive' -c '$trace' '$WORK/sample.arc'" \
+		> "$WORK/pack.sh"
+	echo "'$BUILDDIR/trace_archive' -x '$WORK/sample.arc' '$WORK/unpacked.bin'" \
+		> "$WORK/unpack.sh"
+
+	run_stage trace_archive_pack "$WORK/pack.sh"
+	report_stage trace_archive_pack records $records \
+		bytes $(file_size "$trace") || return
+	run_stage trace_archive_unpack "$WORK/unpack.sh"
+	report_stage trace_archive_unpack records $records \
+		bytes $(file_size "$trace") || return
+
+	checksum "trace/sample.arc" "$WORK/sample.arc"
+	cmp -s "$trace" "$WORK/unpacked.bin" ||
+		fail "unpacked archive differs from the trace"
+
+	: > "$WORK/query.sh"
+	: > "$WORK/query_arc.sh"
+	for filter in "${TRACE_FILTERS[@]}"; do
+		echo "'$BUILDDIR/trace_query' -n -i '$WORK/1.idx' '$trace'" \
+		     "'$filter' > '$WORK/query.$i.txt'" >> "$WORK/query.sh"
+		echo "'$BUILDDIR/trace_query' -n '$WORK/sample.arc'" \
+		     "'$filter' > '$WORK/query_arc.$i.txt'" >> "$WORK/query_arc.sh"
+		((i++))
+	done
+
+	run_stage trace_query "$WORK/query.sh"
+	report_stage trace_query queries $i || return
+	run_stage trace_query_archive "$WORK/query_arc.sh"
+	report_stage trace_query_archive queries $i || return
+
+	for ((i = 0; i < ${#TRACE_FILTERS[@]}; i++)); do
+		checksum "trace/query.$i" "$WORK/query.$i.txt"
+		cmp -s "$WORK/query.$i.txt" "$WORK/query_arc.$i.txt" ||
+			fail "archive query '${TRACE_FILTERS[$i]}' differs"
+	done
+}
+
+check_golden() {
+	if [ -n "$BENCH_UPDATE" ]; then
+		cp "$SUMS" "$GOLDEN" || exit $?
+		echo "updated $GOLDEN" >&2
+		return
+	fi
+
+	if [ ! -f "$GOLDEN" ]; then
+		fail "no $GOLDEN, run with BENCH_UPDATE=1 to create it"
+		return
+	fi
+
+	# Lines are "sha256  name", compare by name
+	join -j 2 -a 1 -a 2 -e missing -o 0,1.1,2.1 \
+		<(sort -k 2 "$GOLDEN") <(sort -k 2 "$SUMS") |
+	while read -r name golden actual; do
+		[ "$golden" == "$actual" ] && continue
+		echo "$name: golden $golden, got $actual"
+	done > "$WORK/mismatch.txt"
+
+	if [ -s "$WORK/mismatch.txt" ]; then
+		cat "$WORK/mismatch.txt" >&2
+		fail "$(wc -l < "$WORK/mismatch.txt") checksums mismatch"
+	fi
+}
+
+: > "$RESULTS" || exit $?
+: > "$SUMS"
+
+bench_generator
+bench_traces
+check_golden
+
+[ "$FAILED" == "0" ] && echo "all checks passed" >&2
+
+exit $FAILED
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/*
+ * Runs a benchmark stage and records its wall time and peak RSS. The
+ * rusage of wait4() covers all the reaped descendants of the stage too,
+ * so a stage may be a shell script running several tools.
+ */
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s -o result_file command [args...]\n"
+		"\tresult_file gets \"wall_s maxrss_kb exit_status\"\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const char *result_path = NULL;
+	struct timespec start;
+	struct rusage ru;
+	double wall;
+	int status;
+	pid_t pid;
+	FILE *fp;
+	int c;
+
+	while ((c = getopt(argc, argv, "+o:")) != -1) {
+		switch (c) {
+		case 'o':
+			result_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (result_path == NULL || optind == argc) {
+		usage(argv[0]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+
+	if (pid == 0) {
+		execvp(argv[optind], argv + optind);
+		perror(argv[optind]);
+		_exit(127);
+	}
+
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		perror("wait4");
+		return EXIT_FAILURE;
+	}
+
+	wall = elapsed(&start);
+
+	if (WIFEXITED(status)) {
+		status = WEXITSTATUS(status);
+	} else {
+		status = 128 + WTERMSIG(status);
+	}
+
+	fp = fopen(result_path, "w");
+	if (fp == NULL) {
+		perror(result_path);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(fp, "%.6f %ld %d\n", wall, ru.ru_maxrss, status);
+
+	if (fclose(fp) != 0) {
+		perror(result_path);
+		return EXIT_FAILURE;
+	}
+
+	return status;
+}
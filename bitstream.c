@@ -144,7 +144,8 @@ void bitstream_write_u_ne(bitstream_writer *writer, uint32_t value,
 	__bitstream_write_ui(writer, value, bits_nb, 0);
 }
 
-void bitstream_write_ue(bitstream_writer *writer, uint32_t value)
+static void __bitstream_write_ue(bitstream_writer *writer, uint32_t value,
+				 int escape)
 {
 	unsigned leading_zeros = 31 - clz(value + 1);
 
@@ -153,18 +154,136 @@ void bitstream_write_ue(bitstream_writer *writer, uint32_t value)
 	assert(leading_zeros < 17);
 
 	if (value == 0) {
-		bitstream_write_ui(writer, 1, 1);
+		__bitstream_write_ui(writer, 1, 1, escape);
 	} else if (leading_zeros < 16) {
-		bitstream_write_ui(writer, value + 1, leading_zeros * 2 + 1);
+		__bitstream_write_ui(writer, value + 1, leading_zeros * 2 + 1,
+				     escape);
 	} else {
-		bitstream_write_ui(writer, 0, leading_zeros);
-		bitstream_write_ui(writer, value + 1, leading_zeros + 1);
+		__bitstream_write_ui(writer, 0, leading_zeros, escape);
+		__bitstream_write_ui(writer, value + 1, leading_zeros + 1,
+				     escape);
 	}
 }
 
+void bitstream_write_ue(bitstream_writer *writer, uint32_t value)
+{
+	__bitstream_write_ue(writer, value, 1);
+}
+
+void bitstream_write_ue_ne(bitstream_writer *writer, uint32_t value)
+{
+	__bitstream_write_ue(writer, value, 0);
+}
+
 void bitstream_write_se(bitstream_writer *writer, int32_t value)
 {
 	uint32_t mapped = abs(value) * 2 - (value > 0);
 
 	bitstream_write_ue(writer, mapped);
 }
+
+void bitstream_write_se_ne(bitstream_writer *writer, int32_t value)
+{
+	uint32_t mapped = abs(value) * 2 - (value > 0);
+
+	bitstream_write_ue_ne(writer, mapped);
+}
+
+/* Writes out complete bytes, the partial one is kept for further writes */
+int bitstream_flush(bitstream_writer *writer, FILE *fp)
+{
+	fwrite(writer->data_ptr, 1, writer->data_cnt, fp);
+
+	writer->data_ptr[0] = writer->data_ptr[writer->data_cnt];
+	writer->data_cnt = 0;
+
+	return ferror(fp) ? -1 : 0;
+}
+
+/* Drops emulation prevention bytes in place, returns the RBSP size */
+uint32_t bitstream_unescape(uint8_t *data, uint32_t data_size)
+{
+	uint32_t i, n = 0;
+	int zeros = 0;
+
+	for (i = 0; i < data_size; i++) {
+		if (zeros >= 2 && data[i] == 0x03) {
+			zeros = 0;
+			continue;
+		}
+
+		zeros = data[i] == 0 ? zeros + 1 : 0;
+		data[n++] = data[i];
+	}
+
+	return n;
+}
+
+void bitstream_reader_init(bitstream_reader *reader, const uint8_t *data,
+			   uint32_t data_size)
+{
+	reader->data_ptr = data;
+	reader->data_size = data_size;
+	reader->bit_pos = 0;
+	reader->overrun = 0;
+}
+
+/* Reads past the end return zeros and set the overrun */
+uint32_t bitstream_read_ui(bitstream_reader *reader, uint8_t bits_nb)
+{
+	uint32_t value = 0;
+	uint32_t pos;
+
+	assert(bits_nb <= 32);
+
+	while (bits_nb--) {
+		pos = reader->bit_pos++;
+
+		if (pos / 8 >= reader->data_size) {
+			reader->overrun = 1;
+			value <<= 1;
+			continue;
+		}
+
+		value = (value << 1) |
+			((reader->data_ptr[pos / 8] >> (7 - pos % 8)) & 1);
+	}
+
+	return value;
+}
+
+uint32_t bitstream_read_ue(bitstream_reader *reader)
+{
+	unsigned leading_zeros = 0;
+
+	while (bitstream_read_ui(reader, 1) == 0) {
+		if (reader->overrun || ++leading_zeros > 31) {
+			reader->overrun = 1;
+			return 0;
+		}
+	}
+
+	return (1u << leading_zeros) - 1 +
+		bitstream_read_ui(reader, leading_zeros);
+}
+
+int32_t bitstream_read_se(bitstream_reader *reader)
+{
+	uint32_t mapped = bitstream_read_ue(reader);
+
+	return (mapped & 1) ? (int32_t)((mapped + 1) / 2) :
+			      -(int32_t)(mapped / 2);
+}
+
+/* Anything but the rbsp_stop_one_bit and the trailing zeros left */
+int bitstream_more_rbsp_data(const bitstream_reader *reader)
+{
+	uint32_t last = reader->data_size * 8;
+
+	while (last > 0 &&
+	       !((reader->data_ptr[(last - 1) / 8] >> (7 - (last - 1) % 8)) & 1)) {
+		last--;
+	}
+
+	return last > 0 && reader->bit_pos < last - 1;
+}
@@ -19,6 +19,7 @@
 #define BITSTREAM_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #ifndef clz
 #define clz	__builtin_clz
@@ -38,6 +39,14 @@ typedef struct bitstream_writer {
 	int track_escape_seq;
 } bitstream_writer;
 
+/* Reads an RBSP, emulation prevention bytes already removed */
+typedef struct bitstream_reader {
+	const uint8_t *data_ptr;
+	uint32_t data_size;
+	uint32_t bit_pos;
+	int overrun;
+} bitstream_reader;
+
 void bitstream_init(bitstream_writer *writer);
 void bitstream_write_ui(bitstream_writer *writer, uint32_t value,
 			uint8_t bits_nb);
@@ -45,5 +54,16 @@ void bitstream_write_u_ne(bitstream_writer *writer, uint32_t value,
 			  uint8_t bits_nb);
 void bitstream_write_ue(bitstream_writer *writer, uint32_t value);
 void bitstream_write_se(bitstream_writer *writer, int32_t value);
+void bitstream_write_ue_ne(bitstream_writer *writer, uint32_t value);
+void bitstream_write_se_ne(bitstream_writer *writer, int32_t value);
+int bitstream_flush(bitstream_writer *writer, FILE *fp);
+
+uint32_t bitstream_unescape(uint8_t *data, uint32_t data_size);
+void bitstream_reader_init(bitstream_reader *reader, const uint8_t *data,
+			   uint32_t data_size);
+uint32_t bitstream_read_ui(bitstream_reader *reader, uint8_t bits_nb);
+uint32_t bitstream_read_ue(bitstream_reader *reader);
+int32_t bitstream_read_se(bitstream_reader *reader);
+int bitstream_more_rbsp_data(const bitstream_reader *reader);
 
 #endif // BITSTREAM_H
@@ -0,0 +1,133 @@
+#!/usr/bin/perl
+
+# Prints canonical form of the h264_test_generator parameters, so that
+# equivalent parameter sets produce the same string (and cache key).
+#
+# Options are deduplicated (the last one wins, like getopt does) and
+# sorted, slices keep their order but their sub-options are deduplicated
+# and sorted as well. Values are normalized the way atoi() parses them.
+# Short options (-s, -S FILE, -t FILE, -p FILE...) are kept verbatim.
+#
+# With --key first, the digests of the files read by the generator (-S
+# slices, -p template) are appended, so that the string can be a cache key.
+
+use strict;
+use warnings;
+
+use Digest::SHA;
+
+# getopt_long() short options of the generator, 1 if they take a value
+my %short_opts = (o => 1, d => 1, t => 1, p => 1, S => 1, s => 0);
+
+sub atoi {
+    my $val = shift;
+
+    return ($val =~ /^\s*([+-]?\d+)/) ? $1 + 0 : 0;
+}
+
+sub canon_slice {
+    my $subopts = shift;
+    my %sh;
+
+    foreach my $subopt (split(/,/, $subopts)) {
+        my ($name, $val) = split(/=/, $subopt, 2);
+
+        next if (!defined($name) || $name eq '');
+
+        $sh{$name} = defined($val) ? atoi($val) : '';
+    }
+
+    return join(',', map { "$_=$sh{$_}" } sort keys %sh);
+}
+
+sub parse_params {
+    my @args = split(' ', shift);
+    my %opts;
+    my @slices;
+
+    while (@args) {
+        my $arg = shift @args;
+
+        if ($arg =~ /^-([^-].*)$/) {
+            my $cluster = $1;
+
+            while ($cluster ne '') {
+                my $c = substr($cluster, 0, 1, '');
+
+                die "Bad parameter '$arg'\n" if (!exists($short_opts{$c}));
+
+                if (!$short_opts{$c}) {
+                    $opts{"-$c"} = '';
+                    next;
+                }
+
+                $cluster = shift @args if ($cluster eq '');
+                die "Parameter '$arg' requires a value\n" if (!defined($cluster));
+
+                $opts{"-$c"} = $cluster;
+                last;
+            }
+
+            next;
+        }
+
+        my ($name, $val) = ($arg =~ /^--([^=]+)(?:=(.*))?$/);
+
+        die "Bad parameter '$arg'\n" if (!defined($name));
+
+        $val = shift @args if (!defined($val));
+        die "Parameter '$arg' requires a value\n" if (!defined($val));
+
+        if ($name eq 'slice') {
+            push @slices, canon_slice($val);
+        } else {
+            $opts{$name} = atoi($val);
+        }
+    }
+
+    return (\%opts, \@slices);
+}
+
+sub opt_string {
+    my ($name, $val) = @_;
+
+    return "--$name=$val" if ($name !~ /^-/);
+
+    return $val eq '' ? $name : "$name $val";
+}
+
+sub canon_params {
+    my ($opts, $slices) = parse_params(shift);
+
+    return join(' ', (map { opt_string($_, $opts->{$_}) } sort keys %$opts),
+                     (map { "--slice=$_" } @$slices));
+}
+
+sub params_key {
+    my $params = shift;
+    my ($opts) = parse_params($params);
+    my $key = canon_params($params);
+
+    foreach my $name ('-S', '-p') {
+        my $path = $opts->{$name};
+
+        next if (!defined($path));
+
+        my $sha = Digest::SHA->new(256);
+        $key .= " $name:" . (-r $path ? $sha->addfile($path)->hexdigest :
+                                        'missing');
+    }
+
+    return $key;
+}
+
+if (!caller) {
+    if (@ARGV && $ARGV[0] eq '--key') {
+        shift;
+        print params_key(join(' ', @ARGV)), "\n";
+    } else {
+        print canon_params(join(' ', @ARGV)), "\n";
+    }
+}
+
+1;
@@ -0,0 +1,526 @@
+#!/usr/bin/perl
+
+# Compiles the declarative H.264 syntax schema (h264_syntax.def, see its
+# header for the format) into C: parameters and fields definitions, the
+# long options and sub-options tables, and three functions per syntax
+# structure:
+#
+#   h264_write_NAME()	bitstream writer, runs of the fixed width u()
+#			elements are merged into single writes with the
+#			constant parts folded
+#   h264_emit_NAME()	passes every element to a callback, for the side
+#			log and the template recording
+#   h264_parse_NAME()	reads the structure back from an RBSP
+#
+# plus h264_NAME_deps[], the parameters the structure reads without coding
+# them, so that the generator knows what invalidates an encoded structure.
+#
+# Usage: gen_syntax.pl schema.def out_base (writes out_base.c, out_base.h)
+
+use strict;
+use warnings;
+
+use File::Basename;
+
+@ARGV == 2 or die "Usage: $0 schema.def out_base\n";
+
+my ($schema_path, $out_base) = @ARGV;
+my $out_name = basename($out_base);
+my $guard = uc($out_name) . '_H';
+
+my @defines;	# [ name, value ]
+my @params;	# { prefix, name, default }
+my @structs;	# { name, fields => [ { name, attr } ] }
+my @syntaxes;	# { name, args, locals => [], lines => [] }
+
+my $MAX_RUN_BITS = 32;
+
+sub parse_element {
+    my ($coding, $width, $operand, $line_nb) = @_;
+    my %e = (kind => 'elem', coding => $coding, width => $width,
+             name => $operand);
+
+    if ($operand =~ /^(\w+)\s*=\s*(-?\d+)$/) {
+        $e{name} = $1;
+        $e{const} = $2;
+    } elsif ($operand =~ /^-?\d+$/) {
+        $e{const} = $operand;
+    } elsif ($operand =~ /^((?:\w+->)?\w+)\s*([+-])\s*(\d+)$/) {
+        $e{lvalue} = $1;
+        $e{inverse} = ($2 eq '-' ? '+' : '-') . " $3";
+    } elsif ($operand =~ /^((?:\w+->)?\w+)$/) {
+        $e{lvalue} = $1;
+    } else {
+        die "$schema_path:$line_nb: Bad operand '$operand'\n";
+    }
+
+    $e{value} = defined($e{const}) ? $e{const} : $operand;
+
+    return \%e;
+}
+
+sub load_schema {
+    my $block;
+    my $line_nb = 0;
+
+    open(my $fh, '<', $schema_path) or die "$schema_path: $!\n";
+
+    while (my $line = <$fh>) {
+        $line_nb++;
+        chomp($line);
+
+        # Top level
+        if ($line =~ /^\S/) {
+            next if ($line =~ /^#/);
+
+            $line =~ s/\s*#.*$//;
+
+            if ($line =~ /^define\s+(\w+)\s+(.+)$/) {
+                push @defines, [ $1, $2 ];
+                $block = undef;
+            } elsif ($line =~ /^params\s+(\w+)$/) {
+                $block = { kind => 'params', prefix => $1 };
+            } elsif ($line =~ /^fields\s+(\w+)$/) {
+                $block = { kind => 'fields', name => $1, fields => [] };
+                push @structs, $block;
+            } elsif ($line =~ /^syntax\s+(\w+)\s*(.*)$/) {
+                $block = { kind => 'syntax', name => $1, args => $2,
+                           locals => [], lines => [] };
+                push @syntaxes, $block;
+            } else {
+                die "$schema_path:$line_nb: Unknown directive '$line'\n";
+            }
+            next;
+        }
+
+        die "$schema_path:$line_nb: Line outside of a block\n"
+            if (!defined($block) && $line =~ /\S/);
+        next if (!defined($block));
+
+        if ($line =~ /^\s*#\s*(.*)$/) {
+            push @{$block->{lines}}, { kind => 'comment', text => $1 }
+                if ($block->{kind} eq 'syntax');
+            next;
+        }
+
+        $line =~ s/\s*#.*$//;
+        $line =~ s/^\s+|\s+$//g;
+
+        if ($line eq '') {
+            push @{$block->{lines}}, { kind => 'blank' }
+                if ($block->{kind} eq 'syntax');
+            next;
+        }
+
+        if ($block->{kind} eq 'params') {
+            $line =~ /^(\w+)\s+(-?\d+)$/
+                or die "$schema_path:$line_nb: Bad parameter '$line'\n";
+            push @params, { prefix => $block->{prefix}, name => $1,
+                            default => $2 };
+        } elsif ($block->{kind} eq 'fields') {
+            $line =~ /^(\w+)(?:\s+(flag|hidden))?$/
+                or die "$schema_path:$line_nb: Bad field '$line'\n";
+            push @{$block->{fields}}, { name => $1, attr => $2 // '' };
+        } elsif ($line =~ /^local\s+(\w+)$/) {
+            push @{$block->{locals}}, $1;
+        } elsif ($line =~ /^(?:u\(([^)]+)\)|(ue|se))\s+(.+)$/) {
+            push @{$block->{lines}},
+                parse_element(defined($1) ? 'u' : $2, $1, $3, $line_nb);
+        } elsif ($line =~ /^(if|for|else|\})\b/ || $line =~ /^\}/) {
+            push @{$block->{lines}}, { kind => 'ctrl', text => $line };
+        } elsif ($line =~ /;$/) {
+            push @{$block->{lines}}, { kind => 'stmt', text => $line };
+        } else {
+            die "$schema_path:$line_nb: Can't parse '$line'\n";
+        }
+    }
+
+    close($fh);
+}
+
+# Output lines with the indentation following the braces
+sub emitter {
+    my $out = shift;
+    my $depth = 1;
+    my $blank = 0;
+
+    return sub {
+        my $text = shift;
+
+        if (!defined($text)) {
+            $blank = 1;
+            return;
+        }
+
+        $depth-- if ($text =~ /^\}/);
+
+        # No blank lines right after an opening or before a closing brace
+        push @$out, '' if ($blank && @$out && $out->[-1] ne '' &&
+                           $out->[-1] !~ /\{$/ && $text !~ /^\}/);
+        $blank = 0;
+
+        push @$out, ("\t" x $depth) . $text;
+
+        $depth++ if ($text =~ /\{$/);
+    };
+}
+
+sub coding_enum {
+    my $e = shift;
+
+    return { u => 'H264_TPL_U', ue => 'H264_TPL_UE', se => 'H264_TPL_SE' }->{$e->{coding}};
+}
+
+sub is_fixed {
+    my $e = shift;
+
+    return $e->{kind} eq 'elem' && $e->{coding} eq 'u' &&
+           $e->{width} =~ /^\d+$/;
+}
+
+sub ctrl_text {
+    my ($text, $parse) = @_;
+
+    $text =~ s/more_rbsp_data\(([^()]*)\)/
+               $parse ? 'bitstream_more_rbsp_data(r)' : $1/ge;
+
+    return $text;
+}
+
+sub gen_locals {
+    my ($out, $s, @extra) = @_;
+
+    push @$out, "\t$_;" foreach (@extra);
+    push @$out, "\tint $_;" foreach (@{$s->{locals}});
+    push @$out, '' if (@extra || @{$s->{locals}});
+}
+
+sub func_args {
+    my ($first, $s) = @_;
+
+    return $s->{args} ne '' ? "$first, $s->{args}" : $first;
+}
+
+# Single value of the fixed width elements run, constants folded
+sub run_value {
+    my @run = @_;
+    my $shift = 0;
+    my $const = 0;
+    my @terms;
+
+    $shift += $_->{width} foreach (@run);
+
+    foreach my $e (@run) {
+        my $mask = (1 << $e->{width}) - 1;
+
+        $shift -= $e->{width};
+
+        if (defined($e->{const})) {
+            $const |= ($e->{const} & $mask) << $shift;
+            next;
+        }
+
+        my $value = $e->{value} =~ /^[\w>-]+$/ ? $e->{value} :
+                                                  "($e->{value})";
+        my $term = sprintf("((uint32_t)%s & 0x%X)", $value, $mask);
+
+        $term .= " << $shift" if ($shift);
+        push @terms, $term;
+    }
+
+    push @terms, sprintf('0x%X', $const) if ($const || !@terms);
+
+    return join(" |\n\t\t\t\t  ", @terms);
+}
+
+# Parameters referenced by the syntax that it doesn't code itself
+sub syntax_deps {
+    my $s = shift;
+    my %param = map { ("$_->{prefix}$_->{name}" => 1) } @params;
+    my (%coded, %seen, @deps);
+
+    foreach my $l (@{$s->{lines}}) {
+        $coded{$l->{lvalue}} = 1 if ($l->{kind} eq 'elem' &&
+                                     defined($l->{lvalue}));
+    }
+
+    foreach my $l (@{$s->{lines}}) {
+        my $text = $l->{kind} eq 'elem' ? ($l->{width} // '') . " $l->{value}" :
+                   $l->{kind} eq 'comment' ? '' : ($l->{text} // '');
+
+        foreach my $id ($text =~ /\b(\w+)\b/g) {
+            next if (!$param{$id} || $coded{$id} || $seen{$id}++);
+            push @deps, $id;
+        }
+    }
+
+    return @deps;
+}
+
+sub gen_write {
+    my ($s, $out) = @_;
+    my $put = emitter($out);
+    my $run_blank = 0;
+    my @run;
+
+    my $flush = sub {
+        return if (!@run);
+
+        my $bits = 0;
+        $bits += $_->{width} foreach (@run);
+
+        if (@run == 1) {
+            $put->("bitstream_write_ui(w, $run[0]{value}, $bits);");
+        } else {
+            $put->("/* " . join(', ', map { $_->{name} } @run) . " */");
+            $put->("bitstream_write_ui(w, " . run_value(@run) . ", $bits);");
+        }
+
+        # Blank line seen in the middle of the run goes after it
+        $put->(undef) if ($run_blank);
+        $run_blank = 0;
+        @run = ();
+    };
+
+    foreach my $l (@{$s->{lines}}) {
+        if ($l->{kind} eq 'blank') {
+            if (@run) {
+                $run_blank = 1;
+            } else {
+                $put->(undef);
+            }
+            next;
+        }
+
+        if (is_fixed($l)) {
+            my $bits = 0;
+            $bits += $_->{width} foreach (@run);
+            $flush->() if ($bits + $l->{width} > $MAX_RUN_BITS);
+            push @run, $l;
+            next;
+        }
+
+        $flush->();
+
+        if ($l->{kind} eq 'elem') {
+            if ($l->{coding} eq 'u') {
+                $put->("bitstream_write_ui(w, $l->{value}, $l->{width});");
+            } else {
+                $put->("bitstream_write_$l->{coding}(w, $l->{value});");
+            }
+        } elsif ($l->{kind} eq 'comment') {
+            $put->("/* $l->{text} */");
+        } else {
+            $put->(ctrl_text($l->{text}, 0));
+        }
+    }
+
+    $flush->();
+}
+
+sub gen_emit {
+    my ($s, $out) = @_;
+    my $put = emitter($out);
+
+    foreach my $l (@{$s->{lines}}) {
+        if ($l->{kind} eq 'blank') {
+            $put->(undef);
+        } elsif ($l->{kind} eq 'elem') {
+            my $width = $l->{coding} eq 'u' ? $l->{width} : 0;
+
+            $put->("emit(ctx, \"$l->{name}\", " . coding_enum($l) .
+                   ", $l->{value}, $width);");
+        } elsif ($l->{kind} eq 'comment') {
+            $put->("/* $l->{text} */");
+        } else {
+            $put->(ctrl_text($l->{text}, 0));
+        }
+    }
+}
+
+sub gen_parse {
+    my ($s, $out) = @_;
+    my $put = emitter($out);
+    my %seen;
+
+    # Absent elements are inferred as 0
+    foreach my $l (@{$s->{lines}}) {
+        next if ($l->{kind} ne 'elem' || !defined($l->{lvalue}) ||
+                 $seen{$l->{lvalue}}++);
+        $put->("$l->{lvalue} = 0;");
+    }
+
+    $put->(undef);
+
+    foreach my $l (@{$s->{lines}}) {
+        if ($l->{kind} eq 'blank') {
+            $put->(undef);
+            next;
+        }
+
+        if ($l->{kind} eq 'comment') {
+            $put->("/* $l->{text} */");
+            next;
+        }
+
+        if ($l->{kind} ne 'elem') {
+            $put->(ctrl_text($l->{text}, 1));
+            next;
+        }
+
+        my $width = $l->{coding} eq 'u' ? $l->{width} : 0;
+
+        if ($l->{coding} eq 'u') {
+            $put->("v = bitstream_read_ui(r, $l->{width});");
+        } elsif ($l->{coding} eq 'ue') {
+            $put->("v = bitstream_read_ue(r);");
+        } else {
+            $put->("v = bitstream_read_se(r);");
+        }
+
+        if (defined($l->{lvalue})) {
+            my $inverse = defined($l->{inverse}) ? " $l->{inverse}" : '';
+
+            $put->("$l->{lvalue} = (int32_t)v$inverse;");
+        }
+
+        $put->("if (log != NULL) {");
+        $put->("log(ctx, \"$l->{name}\", " . coding_enum($l) .
+               ", v, $width);");
+        $put->("}");
+    }
+
+    $put->(undef);
+    $put->("return r->overrun ? -1 : 0;");
+}
+
+sub write_header {
+    my $path = "$out_base.h";
+    my @o;
+
+    push @o, "/* Generated by gen_syntax.pl from " . basename($schema_path) .
+             ", don't edit */", '';
+    push @o, "#ifndef $guard", "#define $guard", '';
+    push @o, '#include <stddef.h>', '#include <stdint.h>', '',
+             '#include "bitstream.h"', '';
+
+    push @o, "#define $_->[0]\t$_->[1]" foreach (@defines);
+    push @o, '';
+
+    push @o, "extern int $_->{prefix}$_->{name};" foreach (@params);
+    push @o, '';
+
+    foreach my $st (@structs) {
+        push @o, "struct $st->{name} {";
+        push @o, "\tint $_->{name};" foreach (@{$st->{fields}});
+        push @o, '};', '';
+    }
+
+    push @o, '/* Sub-option of a structure field, flags are 0 or 1 */',
+             'struct h264_syntax_field {', "\tconst char *name;",
+             "\tsize_t offset;", "\tint flag;", '};', '';
+
+    foreach my $st (@structs) {
+        push @o, "extern char *const h264_$st->{name}_subopts[];";
+        push @o, "extern const struct h264_syntax_field h264_$st->{name}_fields[];";
+    }
+    push @o, '';
+
+    push @o, '/* Parameters read but not coded by the structures, NULL terminated */';
+    push @o, "extern int *const h264_$_->{name}_deps[];" foreach (@syntaxes);
+    push @o, '';
+
+    push @o, '/* getopt_long() entries of the parameters */',
+             "#define H264_SYNTAX_LONG_OPTIONS\t\t\t\t\t\\";
+    foreach my $p (@params) {
+        my $name = "$p->{prefix}$p->{name}";
+        push @o, "\t{\"$name\", required_argument, &$name, 0},\t\\";
+    }
+    $o[-1] =~ s/\t\\$//;
+    push @o, '';
+
+    push @o, '/* Coding is one of the H264_TPL_* */',
+             'typedef void (*h264_syntax_emit_fn)(void *ctx, const char *name,',
+             "\t\t\t\t    int coding, uint32_t value, int bits);", '';
+
+    foreach my $s (@syntaxes) {
+        push @o, "void h264_write_$s->{name}(" .
+                 func_args('bitstream_writer *w', $s) . ');';
+        push @o, "void h264_emit_$s->{name}(" .
+                 func_args('h264_syntax_emit_fn emit, void *ctx', $s) . ');';
+        push @o, "int h264_parse_$s->{name}(" .
+                 func_args('bitstream_reader *r, h264_syntax_emit_fn log, void *ctx', $s) . ');';
+        push @o, '';
+    }
+
+    push @o, "#endif // $guard";
+
+    open(my $fh, '>', $path) or die "$path: $!\n";
+    print $fh join("\n", @o), "\n";
+    close($fh) or die "$path: $!\n";
+}
+
+sub write_source {
+    my $path = "$out_base.c";
+    my @o;
+
+    push @o, "/* Generated by gen_syntax.pl from " . basename($schema_path) .
+             ", don't edit */", '';
+    push @o, '#include <stddef.h>', '#include <stdint.h>', '',
+             '#include "bitstream.h"', '#include "h264_template.h"',
+             "#include \"$out_name.h\"", '';
+
+    push @o, "int $_->{prefix}$_->{name} = $_->{default};" foreach (@params);
+    push @o, '';
+
+    foreach my $st (@structs) {
+        my @opts = grep { $_->{attr} ne 'hidden' } @{$st->{fields}};
+
+        push @o, "char *const h264_$st->{name}_subopts[] = {";
+        push @o, "\t\"$_->{name}\"," foreach (@opts);
+        push @o, "\tNULL,", '};', '';
+
+        push @o, "const struct h264_syntax_field h264_$st->{name}_fields[] = {";
+        foreach my $f (@opts) {
+            push @o, "\t{ \"$f->{name}\", offsetof(struct $st->{name}, $f->{name}), " .
+                     ($f->{attr} eq 'flag' ? 1 : 0) . ' },';
+        }
+        push @o, '};', '';
+    }
+
+    foreach my $s (@syntaxes) {
+        push @o, "int *const h264_$s->{name}_deps[] = {";
+        push @o, "\t&$_," foreach (syntax_deps($s));
+        push @o, "\tNULL,", '};', '';
+    }
+
+    foreach my $s (@syntaxes) {
+        push @o, "void h264_write_$s->{name}(" .
+                 func_args('bitstream_writer *w', $s) . ')', '{';
+        gen_locals(\@o, $s);
+        gen_write($s, \@o);
+        push @o, '}', '';
+
+        push @o, "void h264_emit_$s->{name}(" .
+                 func_args('h264_syntax_emit_fn emit, void *ctx', $s) . ')', '{';
+        gen_locals(\@o, $s);
+        gen_emit($s, \@o);
+        push @o, '}', '';
+
+        push @o, "int h264_parse_$s->{name}(" .
+                 func_args('bitstream_reader *r, h264_syntax_emit_fn log, void *ctx', $s) . ')', '{';
+        gen_locals(\@o, $s, 'uint32_t v');
+        gen_parse($s, \@o);
+        push @o, '}', '';
+    }
+
+    pop @o;
+
+    open(my $fh, '>', $path) or die "$path: $!\n";
+    print $fh join("\n", @o), "\n";
+    close($fh) or die "$path: $!\n";
+}
+
+load_schema();
+write_header();
+write_source();
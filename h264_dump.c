@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dumps the SPS, PPS and slice headers of an H.264 Annex B stream using the
+ * parsers generated from h264_syntax.def, in the format of the element logs
+ * h264_test_generator writes, so the two can be diffed. Slice data isn't
+ * parsed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bitstream.h"
+#include "h264_syntax.h"
+#include "h264_template.h"
+
+static const char *out_dir;
+static int slices_nb;
+
+static void log_elem(void *ctx, const char *name, int coding, uint32_t value,
+		     int bits)
+{
+	FILE *fp = ctx;
+
+	(void)bits;
+
+	if (coding == H264_TPL_SE) {
+		fprintf(fp, "%s = %d\n", name, (int32_t)value);
+	} else {
+		fprintf(fp, "%s = %u\n", name, value);
+	}
+}
+
+static FILE * open_log(const char *name_fmt, int id)
+{
+	char name[64];
+	char path[4096];
+	FILE *fp;
+
+	if (out_dir == NULL) {
+		return stdout;
+	}
+
+	snprintf(name, sizeof(name), name_fmt, id);
+	snprintf(path, sizeof(path), "%s/%s", out_dir, name);
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	return fp;
+}
+
+static int close_log(FILE *fp)
+{
+	if (fp == stdout) {
+		return 0;
+	}
+
+	if (ferror(fp) != 0 || fclose(fp) != 0) {
+		perror(out_dir);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int dump_nal(uint8_t *nal, uint32_t size, uint32_t offset)
+{
+	struct slice_header sh = { 0 };
+	bitstream_reader reader;
+	int nal_ref_idc, type;
+	int ret = 0;
+	FILE *fp;
+
+	if (size == 0) {
+		return 0;
+	}
+
+	nal_ref_idc = (nal[0] >> 5) & 3;
+	type = nal[0] & 0x1F;
+
+	if (out_dir == NULL) {
+		printf("NAL at 0x%X: type %d nal_ref_idc %d\n",
+		       offset, type, nal_ref_idc);
+	}
+
+	size = bitstream_unescape(nal + 1, size - 1);
+	bitstream_reader_init(&reader, nal + 1, size);
+
+	switch (type) {
+	case 7:
+		fp = open_log("SPS.txt", 0);
+		ret = h264_parse_seq_parameter_set(&reader, log_elem, fp);
+		break;
+	case 8:
+		fp = open_log("PPS.txt", 0);
+		ret = h264_parse_pic_parameter_set(&reader, log_elem, fp);
+		break;
+	case 1:
+	case 5:
+		sh.is_idr = (type == 5);
+		fp = open_log("slice_%d.txt", slices_nb++);
+		ret = h264_parse_slice_header(&reader, log_elem, fp, &sh,
+					      nal_ref_idc);
+		break;
+	default:
+		return 0;
+	}
+
+	if (ret != 0) {
+		fprintf(stderr, "NAL at 0x%X: type %d is truncated\n",
+			offset, type);
+	}
+
+	if (close_log(fp) != 0) {
+		return -1;
+	}
+
+	return ret;
+}
+
+static uint8_t * read_file(const char *path, uint32_t *size)
+{
+	uint8_t *data = NULL;
+	size_t len = 0, alloc = 0, ret;
+	FILE *fp;
+
+	fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+	if (fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	do {
+		if (len == alloc) {
+			alloc = alloc ? alloc * 2 : 1 << 16;
+			data = realloc(data, alloc);
+			if (data == NULL) {
+				perror(path);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		ret = fread(data + len, 1, alloc - len, fp);
+		len += ret;
+	} while (ret != 0);
+
+	if (ferror(fp) != 0) {
+		perror(path);
+		free(data);
+		data = NULL;
+	}
+
+	if (fp != stdin) {
+		fclose(fp);
+	}
+
+	*size = len;
+
+	return data;
+}
+
+/* NAL units are delimited by the 00 00 01 start codes, Annex B */
+static uint32_t next_start_code(const uint8_t *data, uint32_t size,
+				uint32_t pos)
+{
+	for (; pos + 3 <= size; pos++) {
+		if (data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1) {
+			return pos;
+		}
+	}
+
+	return size;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d dir] stream.h264|-\n"
+		"\t-d write SPS.txt, PPS.txt and slice_N.txt to the directory,\n"
+		"\t   like h264_test_generator -d does\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t size, pos, end, nal_end;
+	uint8_t *data;
+	int err = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "d:")) != -1) {
+		switch (c) {
+		case 'd':
+			out_dir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+	}
+
+	data = read_file(argv[optind], &size);
+	if (data == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	pos = next_start_code(data, size, 0);
+
+	while (pos < size && !err) {
+		pos += 3;
+		end = next_start_code(data, size, pos);
+
+		/* Zero byte of the next 4 bytes start code and trailing zeros */
+		nal_end = end;
+
+		while (nal_end > pos && data[nal_end - 1] == 0) {
+			nal_end--;
+		}
+
+		err = dump_nal(data + pos, nal_end - pos, pos);
+		pos = end;
+	}
+
+	free(data);
+
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
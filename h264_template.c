@@ -0,0 +1,713 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "h264_template.h"
+
+/*
+ * Template file is a host-endian cache: the header, the generator
+ * parameters, the element names, then every NAL with its payload and
+ * elements, then the stream.
+ */
+struct h264_tpl_header {
+	char magic[8];
+	uint32_t params_nb;
+	uint32_t names_nb;
+	uint32_t nals_nb;
+	uint32_t stream_size;
+};
+
+struct h264_tpl_nal_rec {
+	uint8_t header;
+	uint8_t escape_in;
+	uint8_t escape_out;
+	uint8_t pad;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t rbsp_bits;
+	uint32_t elems_nb;
+};
+
+struct h264_tpl_elem_rec {
+	uint32_t name;
+	uint32_t value;
+	uint32_t bitpos;
+	uint32_t count;
+	uint8_t coding;
+	uint8_t bits;
+	uint16_t pad;
+};
+
+struct names_table {
+	const char **names;
+	uint32_t names_nb;
+	uint32_t last;
+};
+
+static uint32_t writer_bits(const bitstream_writer *writer)
+{
+	return writer->data_cnt * 8 + writer->bit_shift;
+}
+
+static void writer_reset(bitstream_writer *writer, int escape)
+{
+	writer->bit_shift = 0;
+	writer->data_cnt = 0;
+	writer->data_ptr[0] = 0;
+	writer->track_escape_seq = escape;
+}
+
+static uint32_t rbsp_bytes(uint32_t bits)
+{
+	return (bits + 7) / 8;
+}
+
+static void encode_elem(bitstream_writer *writer,
+			const struct h264_tpl_elem *elem, uint32_t count)
+{
+	while (count--) {
+		switch (elem->coding) {
+		case H264_TPL_U:
+			bitstream_write_u_ne(writer, elem->value, elem->bits);
+			break;
+		case H264_TPL_UE:
+			bitstream_write_ue_ne(writer, elem->value);
+			break;
+		case H264_TPL_SE:
+			bitstream_write_se_ne(writer, elem->value);
+			break;
+		default:
+			abort();
+		}
+	}
+}
+
+static uint32_t get_bits(const uint8_t *data, uint32_t pos, unsigned bits_nb)
+{
+	unsigned shift = pos % 8;
+	unsigned bytes = (shift + bits_nb + 7) / 8;
+	uint64_t acc = 0;
+	unsigned i;
+
+	for (i = 0; i < bytes; i++) {
+		acc = (acc << 8) | data[pos / 8 + i];
+	}
+
+	acc >>= bytes * 8 - shift - bits_nb;
+
+	return acc & ((1ull << bits_nb) - 1);
+}
+
+/* Payload of unchanged elements is moved to its new bit position as is */
+static void copy_bits(bitstream_writer *writer, const uint8_t *data,
+		      uint32_t pos, uint32_t bits_nb)
+{
+	unsigned chunk;
+
+	while (bits_nb > 0) {
+		chunk = bits_nb > 32 ? 32 : bits_nb;
+		bitstream_write_u_ne(writer, get_bits(data, pos, chunk), chunk);
+		pos += chunk;
+		bits_nb -= chunk;
+	}
+}
+
+void h264_tpl_init(struct h264_tpl *tpl, int shadow)
+{
+	memset(tpl, 0, sizeof(*tpl));
+
+	tpl->shadow = shadow;
+
+	if (shadow) {
+		bitstream_init(&tpl->rbsp);
+	}
+}
+
+void h264_tpl_free(struct h264_tpl *tpl)
+{
+	uint32_t i;
+
+	for (i = 0; i < tpl->nals_nb; i++) {
+		free(tpl->nals[i].rbsp);
+		free(tpl->nals[i].elems);
+	}
+
+	for (i = 0; i < tpl->names_nb; i++) {
+		free(tpl->names[i]);
+	}
+
+	if (tpl->shadow) {
+		free(tpl->rbsp.data_ptr);
+	}
+
+	free(tpl->nals);
+	free(tpl->stream);
+	free(tpl->params);
+	free(tpl->names);
+	memset(tpl, 0, sizeof(*tpl));
+}
+
+void h264_tpl_set_params(struct h264_tpl *tpl, const int *params,
+			 uint32_t params_nb)
+{
+	free(tpl->params);
+
+	tpl->params = malloc(params_nb * sizeof(*params) + 1);
+	assert(tpl->params != NULL);
+
+	memcpy(tpl->params, params, params_nb * sizeof(*params));
+	tpl->params_nb = params_nb;
+}
+
+static void nal_close(struct h264_tpl *tpl)
+{
+	struct h264_tpl_nal *nal;
+
+	if (!tpl->shadow || tpl->nals_nb == 0) {
+		return;
+	}
+
+	nal = &tpl->nals[tpl->nals_nb - 1];
+	nal->rbsp = tpl->rbsp.data_ptr;
+	nal->rbsp_bits = writer_bits(&tpl->rbsp);
+
+	bitstream_init(&tpl->rbsp);
+}
+
+static struct h264_tpl_nal * nal_add(struct h264_tpl *tpl)
+{
+	struct h264_tpl_nal *nal;
+
+	nal_close(tpl);
+
+	if (tpl->nals_nb == tpl->nals_size) {
+		tpl->nals_size = tpl->nals_size * 2 + 16;
+		tpl->nals = realloc(tpl->nals,
+				    tpl->nals_size * sizeof(*tpl->nals));
+		assert(tpl->nals != NULL);
+	}
+
+	nal = &tpl->nals[tpl->nals_nb++];
+	memset(nal, 0, sizeof(*nal));
+	nal->base = -1;
+
+	return nal;
+}
+
+void h264_tpl_nal_begin(struct h264_tpl *tpl, int header, int escape_in,
+			uint32_t offset)
+{
+	struct h264_tpl_nal *nal = nal_add(tpl);
+
+	nal->header = header;
+	nal->escape_in = escape_in;
+	nal->offset = offset;
+
+	if (tpl->nals_nb > 1) {
+		nal[-1].escape_out = escape_in;
+	}
+}
+
+void h264_tpl_nal_reuse(struct h264_tpl *tpl, int base)
+{
+	nal_add(tpl)->base = base;
+}
+
+void h264_tpl_add_elem(struct h264_tpl *tpl, const char *name, int coding,
+		       uint32_t value, int bits)
+{
+	struct h264_tpl_nal *nal;
+	struct h264_tpl_elem *elem;
+
+	assert(tpl->nals_nb > 0);
+	nal = &tpl->nals[tpl->nals_nb - 1];
+	elem = nal->elems_nb ? &nal->elems[nal->elems_nb - 1] : NULL;
+
+	if (elem && elem->name == name && elem->coding == coding &&
+	    elem->value == value &&
+	    (coding != H264_TPL_U || elem->bits == bits)) {
+		elem->count++;
+
+		if (tpl->shadow) {
+			encode_elem(&tpl->rbsp, elem, 1);
+		}
+		return;
+	}
+
+	if (nal->elems_nb == nal->elems_size) {
+		nal->elems_size = nal->elems_size * 2 + 64;
+		nal->elems = realloc(nal->elems,
+				     nal->elems_size * sizeof(*nal->elems));
+		assert(nal->elems != NULL);
+	}
+
+	elem = &nal->elems[nal->elems_nb++];
+	elem->name = name;
+	elem->value = value;
+	elem->count = 1;
+	elem->coding = coding;
+	elem->bits = coding == H264_TPL_U ? bits : 0;
+	elem->bitpos = 0;
+
+	if (tpl->shadow) {
+		elem->bitpos = writer_bits(&tpl->rbsp);
+		encode_elem(&tpl->rbsp, elem, 1);
+		elem->bits = writer_bits(&tpl->rbsp) - elem->bitpos;
+	}
+}
+
+void h264_tpl_finish(struct h264_tpl *tpl, const uint8_t *stream,
+		     uint32_t stream_size, int escape_out)
+{
+	uint32_t i;
+
+	nal_close(tpl);
+
+	for (i = 0; i < tpl->nals_nb; i++) {
+		if (i + 1 < tpl->nals_nb) {
+			tpl->nals[i].size = tpl->nals[i + 1].offset -
+						tpl->nals[i].offset;
+		} else {
+			tpl->nals[i].size = stream_size - tpl->nals[i].offset;
+			tpl->nals[i].escape_out = escape_out;
+		}
+	}
+
+	tpl->stream = malloc(stream_size + 1);
+	assert(tpl->stream != NULL);
+
+	memcpy(tpl->stream, stream, stream_size + 1);
+	tpl->stream_size = stream_size;
+}
+
+static void nal_copy(struct h264_tpl_nal *nal, const struct h264_tpl_nal *src)
+{
+	uint32_t size = rbsp_bytes(src->rbsp_bits);
+
+	nal->header = src->header;
+	nal->rbsp_bits = src->rbsp_bits;
+	nal->rbsp = malloc(size + 1);
+	assert(nal->rbsp != NULL);
+	memcpy(nal->rbsp, src->rbsp, size);
+
+	nal->elems_nb = nal->elems_size = src->elems_nb;
+	nal->elems = malloc(src->elems_nb * sizeof(*nal->elems) + 1);
+	assert(nal->elems != NULL);
+	memcpy(nal->elems, src->elems, src->elems_nb * sizeof(*nal->elems));
+}
+
+/*
+ * Payload is the concatenation of the element codes, so runs of elements
+ * equal to the old ones are bit-copied and only the rest is encoded.
+ */
+static void nal_splice(struct h264_tpl_nal *nal, const struct h264_tpl_nal *old)
+{
+	const struct h264_tpl_elem *o;
+	struct h264_tpl_elem *elem;
+	bitstream_writer w;
+	uint32_t run_first = 0;
+	uint32_t run_end = 0;
+	uint32_t i;
+
+	bitstream_init(&w);
+
+	for (i = 0; i < nal->elems_nb; i++) {
+		elem = &nal->elems[i];
+		o = (old && i < old->elems_nb) ? &old->elems[i] : NULL;
+
+		if (o && o->coding == elem->coding && o->value == elem->value &&
+		    o->count == elem->count &&
+		    (o->coding != H264_TPL_U || o->bits == elem->bits)) {
+			if (o->bitpos != run_end) {
+				copy_bits(&w, old->rbsp, run_first,
+					  run_end - run_first);
+				run_first = run_end = o->bitpos;
+			}
+
+			elem->bitpos = writer_bits(&w) + run_end - run_first;
+			elem->bits = o->bits;
+			run_end += o->bits * o->count;
+			continue;
+		}
+
+		copy_bits(&w, old ? old->rbsp : NULL, run_first,
+			  run_end - run_first);
+		run_first = run_end;
+
+		elem->bitpos = writer_bits(&w);
+		encode_elem(&w, elem, 1);
+		elem->bits = writer_bits(&w) - elem->bitpos;
+		encode_elem(&w, elem, elem->count - 1);
+	}
+
+	copy_bits(&w, old ? old->rbsp : NULL, run_first, run_end - run_first);
+
+	nal->rbsp = w.data_ptr;
+	nal->rbsp_bits = writer_bits(&w);
+}
+
+/*
+ * Every complete payload byte goes through the writer's emulation
+ * prevention, the partial last one is padded by the next NAL header.
+ */
+static void nal_escape(struct h264_tpl_nal *nal, bitstream_writer *w)
+{
+	uint32_t full = nal->rbsp_bits / 8;
+	unsigned tail = nal->rbsp_bits % 8;
+	uint32_t i;
+
+	writer_reset(w, nal->escape_in);
+
+	bitstream_write_u_ne(w, 0x00000001, 32);
+	bitstream_write_u_ne(w, nal->header, 8);
+
+	for (i = 0; i < full; i++) {
+		bitstream_write_ui(w, nal->rbsp[i], 8);
+	}
+
+	if (tail) {
+		bitstream_write_ui(w, nal->rbsp[full] >> (8 - tail), tail);
+	}
+
+	nal->escape_out = w->track_escape_seq;
+
+	if (tail) {
+		bitstream_write_u_ne(w, 0, 8 - tail);
+	}
+}
+
+static void stream_append(struct h264_tpl *tpl, uint32_t *stream_alloc,
+			  const uint8_t *data, uint32_t size)
+{
+	if (tpl->stream_size + size + 1 > *stream_alloc) {
+		*stream_alloc = (tpl->stream_size + size + 1) * 2;
+		tpl->stream = realloc(tpl->stream, *stream_alloc);
+		assert(tpl->stream != NULL);
+	}
+
+	memcpy(tpl->stream + tpl->stream_size, data, size);
+	tpl->stream_size += size;
+}
+
+/*
+ * Builds the stream of tpl, whose NALs are either reused from the base
+ * template or carry freshly recorded elements. Reused NALs are copied as
+ * they are unless the escape state they start with has changed.
+ */
+void h264_tpl_patch(struct h264_tpl *tpl, const struct h264_tpl *base)
+{
+	const struct h264_tpl_nal *b;
+	struct h264_tpl_nal *nal;
+	uint32_t stream_alloc = 0;
+	bitstream_writer w;
+	int escape = ESCAPE_0;
+	uint32_t i;
+
+	bitstream_init(&w);
+
+	free(tpl->stream);
+	tpl->stream = NULL;
+	tpl->stream_size = 0;
+
+	for (i = 0; i < tpl->nals_nb; i++) {
+		nal = &tpl->nals[i];
+		b = nal->base >= 0 ? &base->nals[nal->base] : NULL;
+
+		if (b) {
+			nal_copy(nal, b);
+		} else {
+			nal_splice(nal, i < base->nals_nb ? &base->nals[i] :
+							    NULL);
+		}
+
+		nal->escape_in = escape;
+		nal->offset = tpl->stream_size;
+
+		if (b && b->escape_in == escape) {
+			stream_append(tpl, &stream_alloc,
+				      base->stream + b->offset, b->size);
+			nal->escape_out = b->escape_out;
+		} else {
+			nal_escape(nal, &w);
+			stream_append(tpl, &stream_alloc, w.data_ptr,
+				      w.data_cnt);
+		}
+
+		nal->size = tpl->stream_size - nal->offset;
+		escape = nal->escape_out;
+	}
+
+	stream_append(tpl, &stream_alloc, (const uint8_t *)"", 1);
+	tpl->stream_size--;
+
+	free(w.data_ptr);
+}
+
+/* Byte range the generator dumps for the NAL, see generate_SPS() */
+void h264_tpl_nal_span(const struct h264_tpl *tpl, uint32_t nal,
+		       uint32_t *first, uint32_t *last)
+{
+	const struct h264_tpl_nal *n = &tpl->nals[nal];
+
+	*first = n->offset;
+	*last = n->offset + n->size;
+
+	if (nal > 0 && n[-1].rbsp_bits % 8) {
+		(*first)--;
+	}
+
+	if (n->rbsp_bits % 8) {
+		(*last)--;
+	}
+}
+
+static uint32_t names_lookup(struct names_table *tbl, const char *name)
+{
+	uint32_t i;
+
+	if (tbl->names_nb > 0 && (tbl->names[tbl->last] == name ||
+				  strcmp(tbl->names[tbl->last], name) == 0)) {
+		return tbl->last;
+	}
+
+	for (i = 0; i < tbl->names_nb; i++) {
+		if (tbl->names[i] == name || strcmp(tbl->names[i], name) == 0) {
+			tbl->last = i;
+			return i;
+		}
+	}
+
+	tbl->names = realloc(tbl->names, (i + 1) * sizeof(*tbl->names));
+	assert(tbl->names != NULL);
+
+	tbl->names[i] = name;
+	tbl->names_nb++;
+	tbl->last = i;
+
+	return i;
+}
+
+int h264_tpl_write(const struct h264_tpl *tpl, const char *path)
+{
+	struct h264_tpl_header hdr = {
+		.magic		= H264_TPL_MAGIC,
+		.params_nb	= tpl->params_nb,
+		.nals_nb	= tpl->nals_nb,
+		.stream_size	= tpl->stream_size,
+	};
+	struct names_table tbl = { NULL, 0, 0 };
+	struct h264_tpl_elem_rec erec;
+	struct h264_tpl_nal_rec nrec;
+	const struct h264_tpl_nal *nal;
+	const struct h264_tpl_elem *elem;
+	uint16_t len;
+	uint32_t i, k;
+	FILE *fp;
+
+	for (i = 0; i < tpl->nals_nb; i++) {
+		for (k = 0; k < tpl->nals[i].elems_nb; k++) {
+			names_lookup(&tbl, tpl->nals[i].elems[k].name);
+		}
+	}
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		free(tbl.names);
+		return -1;
+	}
+
+	hdr.names_nb = tbl.names_nb;
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(tpl->params, sizeof(*tpl->params), tpl->params_nb, fp);
+
+	for (i = 0; i < tbl.names_nb; i++) {
+		len = strlen(tbl.names[i]);
+		fwrite(&len, sizeof(len), 1, fp);
+		fwrite(tbl.names[i], 1, len, fp);
+	}
+
+	for (i = 0; i < tpl->nals_nb; i++) {
+		nal = &tpl->nals[i];
+
+		memset(&nrec, 0, sizeof(nrec));
+		nrec.header = nal->header;
+		nrec.escape_in = nal->escape_in;
+		nrec.escape_out = nal->escape_out;
+		nrec.offset = nal->offset;
+		nrec.size = nal->size;
+		nrec.rbsp_bits = nal->rbsp_bits;
+		nrec.elems_nb = nal->elems_nb;
+
+		fwrite(&nrec, sizeof(nrec), 1, fp);
+		fwrite(nal->rbsp, 1, rbsp_bytes(nal->rbsp_bits), fp);
+
+		for (k = 0; k < nal->elems_nb; k++) {
+			elem = &nal->elems[k];
+
+			memset(&erec, 0, sizeof(erec));
+			erec.name = names_lookup(&tbl, elem->name);
+			erec.value = elem->value;
+			erec.bitpos = elem->bitpos;
+			erec.count = elem->count;
+			erec.coding = elem->coding;
+			erec.bits = elem->bits;
+
+			fwrite(&erec, sizeof(erec), 1, fp);
+		}
+	}
+
+	fwrite(tpl->stream, 1, tpl->stream_size + 1, fp);
+
+	free(tbl.names);
+
+	if (ferror(fp) != 0 || fclose(fp) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int read_nal(struct h264_tpl *tpl, struct h264_tpl_nal *nal, FILE *fp)
+{
+	struct h264_tpl_elem_rec erec;
+	struct h264_tpl_nal_rec nrec;
+	uint32_t size, k;
+
+	if (fread(&nrec, sizeof(nrec), 1, fp) != 1) {
+		return -1;
+	}
+
+	nal->header = nrec.header;
+	nal->escape_in = nrec.escape_in;
+	nal->escape_out = nrec.escape_out;
+	nal->offset = nrec.offset;
+	nal->size = nrec.size;
+	nal->rbsp_bits = nrec.rbsp_bits;
+
+	size = rbsp_bytes(nrec.rbsp_bits);
+	nal->rbsp = malloc(size + 1);
+	nal->elems = malloc(nrec.elems_nb * sizeof(*nal->elems) + 1);
+	assert(nal->rbsp != NULL && nal->elems != NULL);
+
+	if (fread(nal->rbsp, 1, size, fp) != size) {
+		return -1;
+	}
+
+	for (k = 0; k < nrec.elems_nb; k++) {
+		if (fread(&erec, sizeof(erec), 1, fp) != 1 ||
+		    erec.name >= tpl->names_nb || erec.count == 0 ||
+		    erec.bitpos + (uint64_t)erec.bits * erec.count >
+				nrec.rbsp_bits) {
+			return -1;
+		}
+
+		nal->elems[k].name = tpl->names[erec.name];
+		nal->elems[k].value = erec.value;
+		nal->elems[k].bitpos = erec.bitpos;
+		nal->elems[k].count = erec.count;
+		nal->elems[k].coding = erec.coding;
+		nal->elems[k].bits = erec.bits;
+		nal->elems_nb++;
+	}
+
+	nal->elems_size = nal->elems_nb;
+
+	return 0;
+}
+
+/* Returns -1 if template is missing or broken */
+int h264_tpl_read(struct h264_tpl *tpl, const char *path)
+{
+	struct h264_tpl_header hdr;
+	struct h264_tpl_nal *nal;
+	uint16_t len;
+	uint32_t i;
+	FILE *fp;
+
+	h264_tpl_init(tpl, 0);
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return -1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, H264_TPL_MAGIC, sizeof(hdr.magic)) != 0) {
+		goto err;
+	}
+
+	tpl->params = malloc(hdr.params_nb * sizeof(*tpl->params) + 1);
+	tpl->names = calloc(hdr.names_nb + 1, sizeof(*tpl->names));
+	assert(tpl->params != NULL && tpl->names != NULL);
+
+	tpl->params_nb = hdr.params_nb;
+
+	if (fread(tpl->params, sizeof(*tpl->params), hdr.params_nb, fp) !=
+			hdr.params_nb) {
+		goto err;
+	}
+
+	for (i = 0; i < hdr.names_nb; i++) {
+		if (fread(&len, sizeof(len), 1, fp) != 1) {
+			goto err;
+		}
+
+		tpl->names[i] = calloc(1, len + 1);
+		assert(tpl->names[i] != NULL);
+		tpl->names_nb++;
+
+		if (fread(tpl->names[i], 1, len, fp) != len) {
+			goto err;
+		}
+	}
+
+	for (i = 0; i < hdr.nals_nb; i++) {
+		nal = nal_add(tpl);
+
+		if (read_nal(tpl, nal, fp) != 0 ||
+		    nal->offset + nal->size > hdr.stream_size) {
+			goto err;
+		}
+	}
+
+	tpl->stream = malloc(hdr.stream_size + 1);
+	assert(tpl->stream != NULL);
+
+	if (fread(tpl->stream, 1, hdr.stream_size + 1, fp) !=
+			hdr.stream_size + 1) {
+		goto err;
+	}
+
+	tpl->stream_size = hdr.stream_size;
+
+	fclose(fp);
+
+	return 0;
+err:
+	fclose(fp);
+	h264_tpl_free(tpl);
+
+	return -1;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H264_TEMPLATE_H
+#define H264_TEMPLATE_H
+
+#include <stdint.h>
+
+#include "bitstream.h"
+
+#define H264_TPL_MAGIC		"H264TPL1"
+
+enum {
+	H264_TPL_U,
+	H264_TPL_UE,
+	H264_TPL_SE,
+};
+
+/* Element repeated count times in a row, macroblocks mostly */
+struct h264_tpl_elem {
+	const char *name;
+	uint32_t value;
+	uint32_t bitpos;	/* position in the NAL payload */
+	uint32_t count;
+	uint8_t coding;
+	uint8_t bits;		/* u(n) width, coded length once encoded */
+};
+
+struct h264_tpl_nal {
+	uint8_t header;
+	uint8_t escape_in;	/* escape tracking leaks across NALs */
+	uint8_t escape_out;
+	int base;		/* NAL of the base template reused as is, or -1 */
+	uint8_t *rbsp;		/* payload before emulation prevention */
+	uint32_t rbsp_bits;
+	uint32_t offset;	/* start code position in the stream */
+	uint32_t size;
+	struct h264_tpl_elem *elems;
+	uint32_t elems_nb;
+	uint32_t elems_size;
+};
+
+/*
+ * Syntax elements of every NAL of a generated stream, with the stream
+ * itself, so that variants differing in a few parameters are produced by
+ * re-encoding only the NALs those parameters touch.
+ */
+struct h264_tpl {
+	struct h264_tpl_nal *nals;
+	uint32_t nals_nb;
+	uint32_t nals_size;
+	uint8_t *stream;	/* stream_size bytes plus the trailing one */
+	uint32_t stream_size;
+	int *params;		/* generator parameters, opaque here */
+	uint32_t params_nb;
+	char **names;		/* storage of names read from a file */
+	uint32_t names_nb;
+	int shadow;		/* record payloads while generating */
+	bitstream_writer rbsp;
+};
+
+void h264_tpl_init(struct h264_tpl *tpl, int shadow);
+void h264_tpl_free(struct h264_tpl *tpl);
+void h264_tpl_set_params(struct h264_tpl *tpl, const int *params,
+			 uint32_t params_nb);
+void h264_tpl_nal_begin(struct h264_tpl *tpl, int header, int escape_in,
+			uint32_t offset);
+void h264_tpl_nal_reuse(struct h264_tpl *tpl, int base);
+void h264_tpl_add_elem(struct h264_tpl *tpl, const char *name, int coding,
+		       uint32_t value, int bits);
+void h264_tpl_finish(struct h264_tpl *tpl, const uint8_t *stream,
+		     uint32_t stream_size, int escape_out);
+void h264_tpl_patch(struct h264_tpl *tpl, const struct h264_tpl *base);
+void h264_tpl_nal_span(const struct h264_tpl *tpl, uint32_t nal,
+		       uint32_t *first, uint32_t *last);
+int h264_tpl_write(const struct h264_tpl *tpl, const char *path);
+int h264_tpl_read(struct h264_tpl *tpl, const char *path);
+
+#endif // H264_TEMPLATE_H
@@ -26,6 +26,8 @@
 #include <sys/types.h>
 
 #include "bitstream.h"
+#include "h264_syntax.h"
+#include "h264_template.h"
 
 #define DUMMY_MACROBLOCK		0x27
 
@@ -34,96 +36,25 @@
 #define WRITE_SE(f, param)		write_se(f, #param, param)
 
 #define MAX(a, b)	(((a) > (b)) ? (a) : (b))
-
-#define P	0
-#define B	1
-#define I	2
-#define SP	3
-#define SI	4
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
 
 static bitstream_writer writer;
 static const char *h264_out_file_path;
 static const char *misc_out_dir;
+static const char *tpl_out_path;
+static const char *tpl_in_path;
+static const char *slices_file_path;
 
-static const int stop_bit = 1;
+/* Stream mode writes out every NAL once it is generated */
+static int stream_mode;
+static FILE *stream_fp;
+static FILE *slices_fp;
 
-/* Sequence parameter set (SPS) */
-static int SPS_profile_idc = 77;
-static int SPS_constraint_set0_flag = 0;
-static int SPS_constraint_set1_flag = 0;
-static int SPS_constraint_set2_flag = 0;
-static int SPS_constraint_set3_flag = 0;
-static int SPS_constraint_set4_flag = 0;
-static int SPS_constraint_set5_flag = 0;
-static int SPS_level_idc = 31;
-static int SPS_seq_parameter_set_id = 0;
-static int SPS_log2_max_frame_num_minus4 = -1;
-static int SPS_pic_order_cnt_type = 2;
-static int SPS_log2_max_pic_order_cnt_lsb_minus4 = -1;
-static int SPS_delta_pic_order_always_zero_flag = 0;
-static int SPS_offset_for_non_ref_pic = 0;
-static int SPS_offset_for_top_to_bottom_field = 0;
-static int SPS_num_ref_frames_in_pic_order_cnt_cycle = 0;
-static int SPS_offset_for_ref_frame = 0;
-static int SPS_max_num_ref_frames = 0;
-static int SPS_gaps_in_frame_num_value_allowed_flag = 0;
-static int SPS_pic_width_in_mbs = 6;
-static int SPS_pic_height_in_map_units = 6;
-static int SPS_frame_mbs_only_flag = 1;
-static int SPS_mb_adaptive_frame_field_flag = 0;
-static int SPS_direct_8x8_inference_flag = 0;
-static int SPS_frame_cropping_flag = 0;
-static int SPS_frame_crop_left_offset = 0;
-static int SPS_frame_crop_right_offset = 0;
-static int SPS_frame_crop_top_offset = 0;
-static int SPS_frame_crop_bottom_offset = 0;
-static int SPS_vui_parameters_present_flag = 0;
-
-/* Picture parameter set (PPS) */
-static int PPS_pic_parameter_set_id = 0;
-static int PPS_seq_parameter_set_id = 0;
-static int PPS_entropy_coding_mode_flag = 0;
-static int PPS_bottom_field_pic_order_in_frame_present_flag = 0;
-static int PPS_num_slice_groups_minus1 = 0;
-static int PPS_num_ref_idx_l0_default_active_minus1 = 0;
-static int PPS_num_ref_idx_l1_default_active_minus1 = 0;
-static int PPS_weighted_pred_flag = 0;
-static int PPS_weighted_bipred_idc = 0;
-static int PPS_pic_init_qp_minus26 = 0;
-static int PPS_pic_init_qs_minus26 = 0;
-static int PPS_chroma_qp_index_offset = 3;
-static int PPS_deblocking_filter_control_present_flag = 1;
-static int PPS_constrained_intra_pred_flag = 0;
-static int PPS_redundant_pic_cnt_present_flag = 0;
-static int PPS_transform_8x8_mode_flag = 0;
-static int PPS_second_chroma_qp_index_offset = 0;
-
-struct slice_header {
-	int slice_type;
-	int first_mb_in_slice;
-	int pic_parameter_set_id;
-	int frame_num;
-	int is_idr;
-	int idr_pic_id;
-	int field_pic_flag;
-	int bottom_field_flag;
-	int no_output_of_prior_pics_flag;
-	int long_term_reference_flag;
-	int adaptive_ref_pic_marking_mode_flag;
-	int cabac_init_idc;
-	int slice_qp_delta;
-	int disable_deblocking_filter_idc;
-	int slice_alpha_c0_offset_div2;
-	int slice_beta_offset_div2;
-	int num_ref_idx_active_override_flag;
-	int num_ref_idx_l0_active_minus1;
-	int num_ref_idx_l1_active_minus1;
-	int ref_pic_list_modification_flag_l0;
-	int ref_pic_list_modification_flag_l1;
-	int direct_spatial_mv_pred_flag;
-	int pic_order_cnt_lsb;
-	int macroblocks_nb;
-};
+/* Elements are recorded into the template, dry run only records them */
+static struct h264_tpl *tpl_rec;
+static int dry_run;
+
+static const int stop_bit = 1;
 
 static struct slice_header **slice_headers;
 static int slices_NB;
@@ -132,13 +63,23 @@ static int max_pic_order_cnt;
 
 static int REF_IDC = 1;
 
+/*
+ * Inter macroblocks of the P/B slices, all of them are skipped by default.
+ * INTER_mvd_range bounds the coded mvd components, in quarter samples. The
+ * motion vectors themselves aren't tracked: they are the decoder's
+ * prediction plus the mvd, so they can drift further over a slice.
+ */
+static int INTER_seed = 1;
+static int INTER_skip_ratio = 100;
+static int INTER_mvd_range = 16;
+
 static char * misc_path(const char *name_fmt, ...)
 {
 	static char fpath[256];
 	char name_formated[64];
 	va_list args;
 
-	if (misc_out_dir == NULL) {
+	if (misc_out_dir == NULL || dry_run) {
 		return NULL;
 	}
 
@@ -169,6 +110,14 @@ static FILE * open_file(const char *fpath)
 
 static void write_ui(FILE *f, const char *param, unsigned val, int size)
 {
+	if (tpl_rec != NULL) {
+		h264_tpl_add_elem(tpl_rec, param, H264_TPL_U, val, size);
+	}
+
+	if (dry_run) {
+		return;
+	}
+
 	bitstream_write_ui(&writer, val, size);
 
 	if (f == NULL) {
@@ -186,6 +135,14 @@ static void write_ui(FILE *f, const char *param, unsigned val, int size)
 
 static void write_ue(FILE *f, const char *param, unsigned val)
 {
+	if (tpl_rec != NULL) {
+		h264_tpl_add_elem(tpl_rec, param, H264_TPL_UE, val, 0);
+	}
+
+	if (dry_run) {
+		return;
+	}
+
 	bitstream_write_ue(&writer, val);
 
 	if (f == NULL) {
@@ -203,6 +160,14 @@ static void write_ue(FILE *f, const char *param, unsigned val)
 
 static void write_se(FILE *f, const char *param, signed val)
 {
+	if (tpl_rec != NULL) {
+		h264_tpl_add_elem(tpl_rec, param, H264_TPL_SE, val, 0);
+	}
+
+	if (dry_run) {
+		return;
+	}
+
 	bitstream_write_se(&writer, val);
 
 	if (f == NULL) {
@@ -218,6 +183,16 @@ static void write_se(FILE *f, const char *param, signed val)
 	assert(ferror(f) == 0);
 }
 
+/* Truncated Exp-Golomb, range is the maximum value */
+static void write_te(FILE *f, const char *param, unsigned val, int range)
+{
+	if (range > 1) {
+		write_ue(f, param, val);
+	} else {
+		write_ui(f, param, !val, 1);
+	}
+}
+
 static void write_bitstream_to_file(const char *path, unsigned data_offset,
 				    unsigned data_size)
 {
@@ -235,80 +210,81 @@ static void write_bitstream_to_file(const char *path, unsigned data_offset,
 	assert(fp_out != NULL);
 	fwrite(writer.data_ptr + data_offset, 1, data_size, fp_out);
 	assert(ferror(fp_out) == 0);
+	assert(fclose(fp_out) == 0);
+}
+
+static void stream_flush(void)
+{
+	if (stream_fp == NULL) {
+		return;
+	}
+
+	if (bitstream_flush(&writer, stream_fp) != 0) {
+		perror(h264_out_file_path);
+		exit(EXIT_FAILURE);
+	}
 }
 
 static void generate_NAL_header(int nal_ref_idc, int nal_unit_type)
 {
+	int header = ((nal_ref_idc & 3) << 5) | (nal_unit_type & 0x1F);
+
+	if (dry_run) {
+		h264_tpl_nal_begin(tpl_rec, header, ESCAPE_0, 0);
+		return;
+	}
+
 	if (writer.bit_shift != 0) { // byte align
 		bitstream_write_u_ne(&writer, 0, 8 - writer.bit_shift);
 	}
+
+	if (tpl_rec != NULL) {
+		h264_tpl_nal_begin(tpl_rec, header, writer.track_escape_seq,
+				   writer.data_cnt);
+	}
+
 	bitstream_write_u_ne(&writer, 0x00000001, 32); // NAL start code
 	bitstream_write_u_ne(&writer, 0, 1); // forbidden zero bit = 0
 	bitstream_write_u_ne(&writer, nal_ref_idc, 2);
 	bitstream_write_u_ne(&writer, nal_unit_type, 5);
 }
 
-static void generate_SPS(void)
+/* Syntax elements go through the template recording and the side log */
+static void emit_elem(void *ctx, const char *param, int coding, uint32_t val,
+		      int bits)
 {
-	FILE *f = open_file( misc_path("SPS.txt") );
-	uint32_t data_cnt_old = writer.data_cnt;
-	int reserved_zero_2bits = 0;
-	int i;
-
-	generate_NAL_header(REF_IDC, 7);
-
-	WRITE_UI(f, SPS_profile_idc, 8);
-	WRITE_UI(f, SPS_constraint_set0_flag, 1);
-	WRITE_UI(f, SPS_constraint_set1_flag, 1);
-	WRITE_UI(f, SPS_constraint_set2_flag, 1);
-	WRITE_UI(f, SPS_constraint_set3_flag, 1);
-	WRITE_UI(f, SPS_constraint_set4_flag, 1);
-	WRITE_UI(f, SPS_constraint_set5_flag, 1);
-	WRITE_UI(f, reserved_zero_2bits, 2);
-	WRITE_UI(f, SPS_level_idc, 8);
-	WRITE_UE(f, SPS_seq_parameter_set_id);
-	WRITE_UE(f, SPS_log2_max_frame_num_minus4);
-	WRITE_UE(f, SPS_pic_order_cnt_type);
-
-	switch (SPS_pic_order_cnt_type) {
-	case 0:
-		WRITE_UE(f, SPS_log2_max_pic_order_cnt_lsb_minus4);
+	switch (coding) {
+	case H264_TPL_U:
+		write_ui(ctx, param, val, bits);
 		break;
-	case 1:
-		WRITE_UI(f, SPS_delta_pic_order_always_zero_flag, 1);
-		WRITE_SE(f, SPS_offset_for_non_ref_pic);
-		WRITE_SE(f, SPS_offset_for_top_to_bottom_field);
-		WRITE_UE(f, SPS_num_ref_frames_in_pic_order_cnt_cycle);
-
-		for (i = 0; i < SPS_num_ref_frames_in_pic_order_cnt_cycle; i++) {
-			WRITE_SE(f, SPS_offset_for_ref_frame);
-		}
+	case H264_TPL_UE:
+		write_ue(ctx, param, val);
+		break;
+	case H264_TPL_SE:
+		write_se(ctx, param, val);
 		break;
 	}
+}
 
-	WRITE_UE(f, SPS_max_num_ref_frames);
-	WRITE_UI(f, SPS_gaps_in_frame_num_value_allowed_flag, 1);
-	WRITE_UE(f, SPS_pic_width_in_mbs - 1);
-	WRITE_UE(f, SPS_pic_height_in_map_units - 1);
-	WRITE_UI(f, SPS_frame_mbs_only_flag, 1);
+/* Elements are only passed one by one if somebody looks at them */
+static int emit_elems(FILE *f)
+{
+	return f != NULL || tpl_rec != NULL || dry_run;
+}
 
-	if (!SPS_frame_mbs_only_flag) {
-		WRITE_UI(f, SPS_mb_adaptive_frame_field_flag, 1);
-	}
+static void generate_SPS(void)
+{
+	FILE *f = open_file( misc_path("SPS.txt") );
+	uint32_t data_cnt_old = writer.data_cnt;
 
-	WRITE_UI(f, SPS_direct_8x8_inference_flag, 1);
-	WRITE_UI(f, SPS_frame_cropping_flag, 1);
+	generate_NAL_header(REF_IDC, 7);
 
-	if (SPS_frame_cropping_flag) {
-		WRITE_UE(f, SPS_frame_crop_left_offset);
-		WRITE_UE(f, SPS_frame_crop_right_offset);
-		WRITE_UE(f, SPS_frame_crop_top_offset);
-		WRITE_UE(f, SPS_frame_crop_bottom_offset);
+	if (emit_elems(f)) {
+		h264_emit_seq_parameter_set(emit_elem, f);
+	} else {
+		h264_write_seq_parameter_set(&writer);
 	}
 
-	WRITE_UI(f, SPS_vui_parameters_present_flag, 1);
-	WRITE_UI(f, stop_bit, 1);
-
 	if (f) {
 		fclose(f);
 	}
@@ -324,30 +300,12 @@ static void generate_PPS(void)
 
 	generate_NAL_header(REF_IDC, 8);
 
-	WRITE_UE(f, PPS_pic_parameter_set_id);
-	WRITE_UE(f, PPS_seq_parameter_set_id);
-	WRITE_UI(f, PPS_entropy_coding_mode_flag, 1);
-	WRITE_UI(f, PPS_bottom_field_pic_order_in_frame_present_flag, 1);
-	WRITE_UE(f, PPS_num_slice_groups_minus1);
-	WRITE_UE(f, PPS_num_ref_idx_l0_default_active_minus1);
-	WRITE_UE(f, PPS_num_ref_idx_l1_default_active_minus1);
-	WRITE_UI(f, PPS_weighted_pred_flag, 1);
-	WRITE_UI(f, PPS_weighted_bipred_idc, 2);
-	WRITE_SE(f, PPS_pic_init_qp_minus26);
-	WRITE_SE(f, PPS_pic_init_qs_minus26);
-	WRITE_SE(f, PPS_chroma_qp_index_offset);
-	WRITE_UI(f, PPS_deblocking_filter_control_present_flag, 1);
-	WRITE_UI(f, PPS_constrained_intra_pred_flag, 1);
-	WRITE_UI(f, PPS_redundant_pic_cnt_present_flag, 1);
-
-	if (PPS_transform_8x8_mode_flag) {
-		WRITE_UI(f, PPS_transform_8x8_mode_flag, 1);
-		WRITE_UI(f, 0/*PPS_pic_scaling_matrix_present_flag*/, 1);
-		WRITE_SE(f, PPS_second_chroma_qp_index_offset);
+	if (emit_elems(f)) {
+		h264_emit_pic_parameter_set(emit_elem, f);
+	} else {
+		h264_write_pic_parameter_set(&writer);
 	}
 
-	WRITE_UI(f, stop_bit, 1);
-
 	if (f) {
 		fclose(f);
 	}
@@ -361,101 +319,316 @@ static void generate_dummy_I_macroblock(FILE *f)
 	WRITE_UI(f, DUMMY_MACROBLOCK, 8);
 }
 
-static void generate_slice(struct slice_header *sh, int slice_id)
+#define PRED_L0		1
+#define PRED_L1		2
+#define PRED_BI		(PRED_L0 | PRED_L1)
+
+#define B_DIRECT_16x16	0
+
+struct mb_type_desc {
+	int parts_nb;
+	int pred[2];
+};
+
+/* P_8x8ref0 isn't generated */
+static const struct mb_type_desc P_mb_types[] = {
+	{ 1, { PRED_L0 } },			/* P_L0_16x16 */
+	{ 2, { PRED_L0, PRED_L0 } },		/* P_L0_L0_16x8 */
+	{ 2, { PRED_L0, PRED_L0 } },		/* P_L0_L0_8x16 */
+	{ 4, { 0 } },				/* P_8x8 */
+};
+
+static const struct mb_type_desc B_mb_types[] = {
+	{ 0, { 0 } },				/* B_Direct_16x16 */
+	{ 1, { PRED_L0 } },			/* B_L0_16x16 */
+	{ 1, { PRED_L1 } },			/* B_L1_16x16 */
+	{ 1, { PRED_BI } },			/* B_Bi_16x16 */
+	{ 2, { PRED_L0, PRED_L0 } },		/* B_L0_L0_16x8 */
+	{ 2, { PRED_L0, PRED_L0 } },		/* B_L0_L0_8x16 */
+	{ 2, { PRED_L1, PRED_L1 } },		/* B_L1_L1_16x8 */
+	{ 2, { PRED_L1, PRED_L1 } },		/* B_L1_L1_8x16 */
+	{ 2, { PRED_L0, PRED_L1 } },		/* B_L0_L1_16x8 */
+	{ 2, { PRED_L0, PRED_L1 } },		/* B_L0_L1_8x16 */
+	{ 2, { PRED_L1, PRED_L0 } },		/* B_L1_L0_16x8 */
+	{ 2, { PRED_L1, PRED_L0 } },		/* B_L1_L0_8x16 */
+	{ 2, { PRED_L0, PRED_BI } },		/* B_L0_Bi_16x8 */
+	{ 2, { PRED_L0, PRED_BI } },		/* B_L0_Bi_8x16 */
+	{ 2, { PRED_L1, PRED_BI } },		/* B_L1_Bi_16x8 */
+	{ 2, { PRED_L1, PRED_BI } },		/* B_L1_Bi_8x16 */
+	{ 2, { PRED_BI, PRED_L0 } },		/* B_Bi_L0_16x8 */
+	{ 2, { PRED_BI, PRED_L0 } },		/* B_Bi_L0_8x16 */
+	{ 2, { PRED_BI, PRED_L1 } },		/* B_Bi_L1_16x8 */
+	{ 2, { PRED_BI, PRED_L1 } },		/* B_Bi_L1_8x16 */
+	{ 2, { PRED_BI, PRED_BI } },		/* B_Bi_Bi_16x8 */
+	{ 2, { PRED_BI, PRED_BI } },		/* B_Bi_Bi_8x16 */
+	{ 4, { 0 } },				/* B_8x8 */
+};
+
+/* Sub-macroblock partitions number and prediction, 0 is B_Direct_8x8 */
+static const int P_sub_mb_types[][2] = {
+	{ 1, PRED_L0 }, { 2, PRED_L0 }, { 2, PRED_L0 }, { 4, PRED_L0 },
+};
+
+static const int B_sub_mb_types[][2] = {
+	{ 4, 0 },
+	{ 1, PRED_L0 }, { 1, PRED_L1 }, { 1, PRED_BI },
+	{ 2, PRED_L0 }, { 2, PRED_L0 }, { 2, PRED_L1 }, { 2, PRED_L1 },
+	{ 2, PRED_BI }, { 2, PRED_BI },
+	{ 4, PRED_L0 }, { 4, PRED_L1 }, { 4, PRED_BI },
+};
+
+/* Inter coded_block_pattern codeNum of the luma-only patterns, table 9-4 */
+static const int inter_cbp_code[16] = {
+	0, 2, 3, 7, 4, 8, 17, 13, 5, 18, 9, 14, 10, 15, 16, 11,
+};
+
+/* total_zeros of TotalCoeff = 1 in 4x4 blocks: code and length, table 9-7 */
+static const uint8_t total_zeros_1[16][2] = {
+	{ 1, 1 }, { 3, 3 }, { 2, 3 }, { 3, 4 }, { 2, 4 }, { 3, 5 }, { 2, 5 },
+	{ 3, 6 }, { 2, 6 }, { 3, 7 }, { 2, 7 }, { 3, 8 }, { 2, 8 }, { 3, 9 },
+	{ 2, 9 }, { 1, 9 },
+};
+
+static uint32_t inter_rng;
+
+/* xorshift32, seeded per slice so that slices can be generated alone */
+static uint32_t inter_rand(void)
 {
-	FILE *f = open_file( misc_path("slice_%d.txt", slice_id) );
-	int pic_height = SPS_pic_height_in_map_units * (2 - SPS_frame_mbs_only_flag);
-	uint32_t data_cnt_old = writer.data_cnt;
-	int slice_type = sh->slice_type;
-	int macroblocks_nb = sh->macroblocks_nb ?: SPS_pic_width_in_mbs * pic_height;
+	inter_rng ^= inter_rng << 13;
+	inter_rng ^= inter_rng >> 17;
+	inter_rng ^= inter_rng << 5;
 
-	generate_NAL_header(REF_IDC, sh->is_idr ? 5 : 1);
+	return inter_rng;
+}
 
-	WRITE_UE(f, sh->first_mb_in_slice);
-	WRITE_UE(f, sh->slice_type);
-	WRITE_UE(f, sh->pic_parameter_set_id);
-	WRITE_UI(f, sh->frame_num, SPS_log2_max_frame_num_minus4 + 4);
+static void inter_seed(int slice_id)
+{
+	inter_rng = (uint32_t)INTER_seed * 2654435761u ^
+			(uint32_t)(slice_id + 1) * 0x85EBCA6Bu;
 
-	slice_type %= 5;
+	if (inter_rng == 0) {
+		inter_rng = 1;
+	}
+}
 
-	if (sh->is_idr) {
-		assert(slice_type == 2);
-		WRITE_UE(f, sh->idr_pic_id);
+static void generate_mvd(FILE *f, int list)
+{
+	int range = MAX(INTER_mvd_range, 0);
+	int mvd_x = (int)(inter_rand() % (2 * range + 1)) - range;
+	int mvd_y = (int)(inter_rand() % (2 * range + 1)) - range;
+
+	write_se(f, list ? "mvd_l1[0]" : "mvd_l0[0]", mvd_x);
+	write_se(f, list ? "mvd_l1[1]" : "mvd_l0[1]", mvd_y);
+}
+
+/*
+ * Every 4x4 block has at most a single +-1 coefficient, so nC of the
+ * following blocks stays below 2 and coeff_token never depends on the
+ * neighbours.
+ */
+static void generate_residual_block(FILE *f)
+{
+	int coeff_token, trailing_ones_sign_flag, total_zeros;
+
+	if (inter_rand() & 1) {
+		coeff_token = 1;		/* TotalCoeff = 0 */
+		WRITE_UI(f, coeff_token, 1);
+		return;
 	}
 
-	if (SPS_pic_order_cnt_type == 0) {
-		WRITE_UI(f, sh->pic_order_cnt_lsb,
-			 SPS_log2_max_pic_order_cnt_lsb_minus4 + 4);
+	coeff_token = 1;			/* TotalCoeff = 1, T1s = 1 */
+	WRITE_UI(f, coeff_token, 2);
+
+	trailing_ones_sign_flag = inter_rand() & 1;
+	WRITE_UI(f, trailing_ones_sign_flag, 1);
+
+	total_zeros = inter_rand() % 16;
+	write_ui(f, "total_zeros", total_zeros_1[total_zeros][0],
+		 total_zeros_1[total_zeros][1]);
+}
+
+/* CAVLC, non-MBAFF, 4:2:0 */
+static void generate_inter_macroblock(FILE *f, int slice_type,
+				      const int num_ref_idx_active_minus1[2])
+{
+	const struct mb_type_desc *desc;
+	int sub_pred[4], sub_parts[4];
+	int no_sub_mb_part_size_less_than_8x8 = 1;
+	int mb_type, sub_mb_type, coded_block_pattern;
+	int transform_size_8x8_flag = 0, mb_qp_delta = 0;
+	int cbp_luma, parts_nb, list, i, k;
+
+	if (slice_type == P) {
+		mb_type = inter_rand() % ARRAY_SIZE(P_mb_types);
+		desc = &P_mb_types[mb_type];
+	} else {
+		mb_type = inter_rand() % ARRAY_SIZE(B_mb_types);
+		desc = &B_mb_types[mb_type];
 	}
 
-	if (slice_type == P || slice_type == B) {
-		if (slice_type == B) {
-			WRITE_UI(f, sh->direct_spatial_mv_pred_flag, 1);
-		}
+	WRITE_UE(f, mb_type);
 
-		WRITE_UI(f, sh->num_ref_idx_active_override_flag, 1);
+	if (desc->parts_nb == 4) {
+		for (i = 0; i < 4; i++) {
+			if (slice_type == P) {
+				sub_mb_type = inter_rand() % ARRAY_SIZE(P_sub_mb_types);
+				sub_parts[i] = P_sub_mb_types[sub_mb_type][0];
+				sub_pred[i] = P_sub_mb_types[sub_mb_type][1];
+			} else {
+				sub_mb_type = inter_rand() % ARRAY_SIZE(B_sub_mb_types);
+				sub_parts[i] = B_sub_mb_types[sub_mb_type][0];
+				sub_pred[i] = B_sub_mb_types[sub_mb_type][1];
+			}
 
-		if (sh->num_ref_idx_active_override_flag) {
-			WRITE_UE(f, sh->num_ref_idx_l0_active_minus1);
+			WRITE_UE(f, sub_mb_type);
 
-			if (slice_type == B) {
-				WRITE_UE(f, sh->num_ref_idx_l1_active_minus1);
+			if (sub_pred[i] == 0) {
+				if (!SPS_direct_8x8_inference_flag) {
+					no_sub_mb_part_size_less_than_8x8 = 0;
+				}
+			} else if (sub_parts[i] > 1) {
+				no_sub_mb_part_size_less_than_8x8 = 0;
 			}
 		}
+
+		parts_nb = 4;
+	} else {
+		for (i = 0; i < desc->parts_nb; i++) {
+			sub_pred[i] = desc->pred[i];
+			sub_parts[i] = 1;
+		}
+
+		parts_nb = desc->parts_nb;
 	}
 
-	if (slice_type != I && slice_type != SI) {
-		WRITE_UI(f, sh->ref_pic_list_modification_flag_l0, 1);
-
-// 		if (ref_pic_list_modification_flag_l0) {
-// 			do {
-// 				WRITE_UI(f, modification_of_pic_nums_idc, 1);
-//
-// 				if (modification_of_pic_nums_idc == 0 ||
-// 					modification_of_pic_nums_idc == 1)
-// 				{
-// 					abs_diff_pic_num_minus1
-// 				} else if (modification_of_pic_nums_idc == 2) {
-// 					long_term_pic_num
-// 				}
-// 			} while (modification_of_pic_nums_idc != 3);
-// 		}
-
-		if (slice_type == B) {
-			WRITE_UI(f, sh->ref_pic_list_modification_flag_l1, 1);
+	for (list = 0; list < 2; list++) {
+		for (i = 0; i < parts_nb; i++) {
+			if (num_ref_idx_active_minus1[list] > 0 &&
+			    (sub_pred[i] & (1 << list))) {
+				write_te(f, list ? "ref_idx_l1" : "ref_idx_l0",
+					 inter_rand() % (num_ref_idx_active_minus1[list] + 1),
+					 num_ref_idx_active_minus1[list]);
+			}
 		}
 	}
 
-	if (!SPS_frame_mbs_only_flag) {
-		WRITE_UI(f, sh->field_pic_flag, 1);
+	for (list = 0; list < 2; list++) {
+		for (i = 0; i < parts_nb; i++) {
+			if (!(sub_pred[i] & (1 << list))) {
+				continue;
+			}
 
-		if (sh->field_pic_flag) {
-			WRITE_UI(f, sh->bottom_field_flag, 1);
+			for (k = 0; k < sub_parts[i]; k++) {
+				generate_mvd(f, list);
+			}
 		}
 	}
 
-	if (REF_IDC != 0) {
-		if (sh->is_idr) {
-			WRITE_UI(f, sh->no_output_of_prior_pics_flag, 1);
-			WRITE_UI(f, sh->long_term_reference_flag, 1);
-		} else {
-			WRITE_UI(f, sh->adaptive_ref_pic_marking_mode_flag, 1);
+	cbp_luma = inter_rand() % 16;
+	coded_block_pattern = inter_cbp_code[cbp_luma];
+	WRITE_UE(f, coded_block_pattern);
+
+	if (cbp_luma == 0) {
+		return;
+	}
+
+	if (PPS_transform_8x8_mode_flag && no_sub_mb_part_size_less_than_8x8 &&
+	    (slice_type != B || mb_type != B_DIRECT_16x16 ||
+	     SPS_direct_8x8_inference_flag)) {
+		WRITE_UI(f, transform_size_8x8_flag, 1);
+	}
+
+	WRITE_SE(f, mb_qp_delta);
+
+	for (i = 0; i < 16; i++) {
+		if (cbp_luma & (1 << (i / 4))) {
+			generate_residual_block(f);
 		}
 	}
+}
 
-	if (slice_type != I && slice_type != SI && PPS_entropy_coding_mode_flag) {
-		WRITE_UE(f, sh->cabac_init_idc);
+/*
+ * Skipped macroblocks are the INTER_skip_ratio percentage of all, the
+ * coded ones are preceded by the run of skipped.
+ */
+static void generate_inter_macroblocks(FILE *f, struct slice_header *sh,
+				       int slice_id, int macroblocks_nb)
+{
+	int slice_type = sh->slice_type % 5;
+	int num_ref_idx_active_minus1[2];
+	int mb_skip_run = 0;
+
+	if (sh->num_ref_idx_active_override_flag) {
+		num_ref_idx_active_minus1[0] = sh->num_ref_idx_l0_active_minus1;
+		num_ref_idx_active_minus1[1] = sh->num_ref_idx_l1_active_minus1;
+	} else {
+		num_ref_idx_active_minus1[0] = PPS_num_ref_idx_l0_default_active_minus1;
+		num_ref_idx_active_minus1[1] = PPS_num_ref_idx_l1_default_active_minus1;
 	}
 
-	WRITE_SE(f, sh->slice_qp_delta);
+	if (slice_type == P) {
+		num_ref_idx_active_minus1[1] = 0;
+	}
 
-	if (PPS_deblocking_filter_control_present_flag) {
-		WRITE_UE(f, sh->disable_deblocking_filter_idc);
+	inter_seed(slice_id);
 
-		if (sh->disable_deblocking_filter_idc != 1) {
-			WRITE_SE(f, sh->slice_alpha_c0_offset_div2);
-			WRITE_SE(f, sh->slice_beta_offset_div2);
+	while (macroblocks_nb--) {
+		if ((int)(inter_rand() % 100) < INTER_skip_ratio) {
+			mb_skip_run++;
+			continue;
 		}
+
+		WRITE_UE(f, mb_skip_run);
+		generate_inter_macroblock(f, slice_type,
+					  num_ref_idx_active_minus1);
+		mb_skip_run = 0;
+	}
+
+	if (mb_skip_run) {
+		WRITE_UE(f, mb_skip_run);
+	}
+}
+
+/*
+ * Parameters that the slice data reads, see patch_h264(). The slice header
+ * ones are listed in h264_slice_header_deps[], generated from the schema.
+ */
+static int * const slice_data_deps[] = {
+	&SPS_pic_width_in_mbs,
+	&SPS_pic_height_in_map_units,
+	&SPS_frame_mbs_only_flag,
+	&SPS_mb_adaptive_frame_field_flag,
+	&SPS_direct_8x8_inference_flag,
+	&PPS_entropy_coding_mode_flag,
+	&PPS_num_ref_idx_l0_default_active_minus1,
+	&PPS_num_ref_idx_l1_default_active_minus1,
+	&PPS_transform_8x8_mode_flag,
+	&REF_IDC,
+	&INTER_seed,
+	&INTER_skip_ratio,
+	&INTER_mvd_range,
+};
+
+static void generate_slice(struct slice_header *sh, int slice_id)
+{
+	FILE *f = open_file( misc_path("slice_%d.txt", slice_id) );
+	int pic_height = SPS_pic_height_in_map_units * (2 - SPS_frame_mbs_only_flag);
+	uint32_t data_cnt_old = writer.data_cnt;
+	int slice_type = sh->slice_type;
+	int macroblocks_nb = sh->macroblocks_nb ?: SPS_pic_width_in_mbs * pic_height;
+
+	generate_NAL_header(REF_IDC, sh->is_idr ? 5 : 1);
+
+	slice_type %= 5;
+
+	if (sh->is_idr) {
+		assert(slice_type == 2);
+	}
+
+	if (emit_elems(f)) {
+		h264_emit_slice_header(emit_elem, f, sh, REF_IDC);
+	} else {
+		h264_write_slice_header(&writer, sh, REF_IDC);
 	}
 
 	switch (slice_type) {
@@ -466,7 +639,15 @@ static void generate_slice(struct slice_header *sh, int slice_id)
 		break;
 	case P:
 	case B:
-		WRITE_UE(f, macroblocks_nb);
+		/* CABAC and MBAFF macroblocks aren't generated, all skipped */
+		if (INTER_skip_ratio >= 100 || PPS_entropy_coding_mode_flag ||
+		    (!SPS_frame_mbs_only_flag && SPS_mb_adaptive_frame_field_flag &&
+		     !sh->field_pic_flag)) {
+			WRITE_UE(f, macroblocks_nb);
+			break;
+		}
+
+		generate_inter_macroblocks(f, sh, slice_id, macroblocks_nb);
 		break;
 	default:
 		assert(0);
@@ -482,87 +663,57 @@ static void generate_slice(struct slice_header *sh, int slice_id)
 			data_cnt_old, writer.data_cnt - data_cnt_old + 1);
 }
 
-static void generate_h264(void)
+static void derive_parameters(void)
 {
-	int i;
-
+	/* clz(0) is undefined */
 	if (SPS_log2_max_frame_num_minus4 == -1) {
-		SPS_log2_max_frame_num_minus4 = MAX(28 - clz(max_frame_nb), 0);
+		SPS_log2_max_frame_num_minus4 = max_frame_nb ?
+				MAX(28 - clz(max_frame_nb), 0) : 0;
 	}
 
 	if (SPS_log2_max_pic_order_cnt_lsb_minus4 == -1) {
-		SPS_log2_max_pic_order_cnt_lsb_minus4 = MAX(28 - clz(max_pic_order_cnt), 0);
+		SPS_log2_max_pic_order_cnt_lsb_minus4 = max_pic_order_cnt ?
+				MAX(28 - clz(max_pic_order_cnt), 0) : 0;
 	}
+}
+
+static int read_slice(FILE *fp, struct slice_header *sh);
+
+static void generate_h264(void)
+{
+	struct slice_header sh;
+	int i;
+
+	derive_parameters();
 
 	generate_SPS();
+	stream_flush();
 	generate_PPS();
+	stream_flush();
 
 	for (i = 0; i < slices_NB; i++) {
 		generate_slice(slice_headers[i], i);
+		stream_flush();
+	}
+
+	/* In stream mode slices of the file are read again one by one */
+	while (slices_fp != NULL && read_slice(slices_fp, &sh)) {
+		generate_slice(&sh, i++);
+		stream_flush();
 	}
 
 	generate_NAL_header(REF_IDC, 11); // End of stream
 }
 
-static void parse_sh_params(void)
-{
-	struct slice_header *sh = calloc(1, sizeof(*sh));
-
-	enum {
-		SLICE_TYPE,
-		FIRST_MB_IN_SLICE,
-		PIC_PARAMETER_SET_ID,
-		FRAME_NUM,
-		IS_IDR,
-		IDR_PIC_ID,
-		FIELD_PIC_FLAG,
-		BOTTOM_FIELD_FLAG,
-		NO_OUTPUT_OF_PRIOR_PICS_FLAG,
-		LONG_TERM_REFERENCE_FLAG,
-		CABAC_INIT_IDC,
-		SLICE_QP_DELTA,
-		DISABLE_DEBLOCKING_FILTER_IDC,
-		SLICE_ALPHA_C0_OFFSET_DIV2,
-		SLICE_BETA_OFFSET_DIV2,
-		NUM_REF_IDX_ACTIVE_OVERRIDE_FLAG,
-		NUM_REF_IDX_L0_ACTIVE_MINUS1,
-		NUM_REF_IDX_L1_ACTIVE_MINUS1,
-		DIRECT_SPATIAL_MV_PRED_FLAG,
-		PIC_ORDER_CNT_LSB,
-		MACROBLOCKS_NB,
-		SENTINEL,
-	};
-
-	char *const params[] = {
-		[SLICE_TYPE]			= "slice_type",
-		[FIRST_MB_IN_SLICE]		= "first_mb_in_slice",
-		[PIC_PARAMETER_SET_ID]		= "pic_parameter_set_id",
-		[FRAME_NUM]			= "frame_num",
-		[IS_IDR]			= "is_idr",
-		[IDR_PIC_ID]			= "idr_pic_id",
-		[FIELD_PIC_FLAG]		= "field_pic_flag",
-		[BOTTOM_FIELD_FLAG]		= "bottom_field_flag",
-		[NO_OUTPUT_OF_PRIOR_PICS_FLAG]	= "no_output_of_prior_pics_flag",
-		[LONG_TERM_REFERENCE_FLAG]	= "long_term_reference_flag",
-		[CABAC_INIT_IDC]		= "cabac_init_idc",
-		[SLICE_QP_DELTA]		= "slice_qp_delta",
-		[DISABLE_DEBLOCKING_FILTER_IDC]	= "disable_deblocking_filter_idc",
-		[SLICE_ALPHA_C0_OFFSET_DIV2]	= "slice_alpha_c0_offset_div2",
-		[SLICE_BETA_OFFSET_DIV2]	= "slice_beta_offset_div2",
-		[NUM_REF_IDX_ACTIVE_OVERRIDE_FLAG] = "num_ref_idx_active_override_flag",
-		[NUM_REF_IDX_L0_ACTIVE_MINUS1]	= "num_ref_idx_l0_active_minus1",
-		[NUM_REF_IDX_L1_ACTIVE_MINUS1]	= "num_ref_idx_l1_active_minus1",
-		[DIRECT_SPATIAL_MV_PRED_FLAG]	= "direct_spatial_mv_pred_flag",
-		[PIC_ORDER_CNT_LSB]		= "pic_order_cnt_lsb",
-		[MACROBLOCKS_NB]		= "macroblocks_nb",
-		[SENTINEL]			= NULL,
-	};
-	char *subopts = optarg, *value;
-
-	assert(sh != NULL);
+static void parse_sh_params(struct slice_header *sh, char *subopts)
+{
+	const struct h264_syntax_field *field;
+	char *value;
+	int *param;
 
 	while (*subopts != '\0') {
-		int param_id = getsubopt(&subopts, params, &value);
+		int param_id = getsubopt(&subopts, h264_slice_header_subopts,
+					 &value);
 
 		if (param_id < 0) {
 			printf ("Unknown suboption '%s'\n", value);
@@ -571,162 +722,125 @@ static void parse_sh_params(void)
 
 		assert(value != NULL);
 
-		switch (param_id) {
-		case SLICE_TYPE:
-			sh->slice_type = atoi(value);
-			break;
-		case FIRST_MB_IN_SLICE:
-			sh->first_mb_in_slice = atoi(value);
-			break;
-		case PIC_PARAMETER_SET_ID:
-			sh->pic_parameter_set_id = atoi(value);
-			break;
-		case FRAME_NUM:
-			sh->frame_num = atoi(value);
-			break;
-		case IS_IDR:
-			sh->is_idr = atoi(value);
-			break;
-		case IDR_PIC_ID:
-			sh->idr_pic_id = atoi(value);
-			break;
-		case FIELD_PIC_FLAG:
-			sh->field_pic_flag = atoi(value);
-			assert(sh->field_pic_flag <= 1);
-			assert(sh->field_pic_flag >= 0);
-			break;
-		case BOTTOM_FIELD_FLAG:
-			sh->bottom_field_flag = atoi(value);
-			assert(sh->bottom_field_flag <= 1);
-			assert(sh->bottom_field_flag >= 0);
-			break;
-		case NO_OUTPUT_OF_PRIOR_PICS_FLAG:
-			sh->no_output_of_prior_pics_flag = atoi(value);
-			assert(sh->no_output_of_prior_pics_flag <= 1);
-			assert(sh->no_output_of_prior_pics_flag >= 0);
-			break;
-		case LONG_TERM_REFERENCE_FLAG:
-			sh->long_term_reference_flag = atoi(value);
-			assert(sh->long_term_reference_flag <= 1);
-			assert(sh->long_term_reference_flag >= 0);
-			break;
-		case CABAC_INIT_IDC:
-			sh->cabac_init_idc = atoi(value);
-			break;
-		case SLICE_QP_DELTA:
-			sh->slice_qp_delta = atoi(value);
-			break;
-		case DISABLE_DEBLOCKING_FILTER_IDC:
-			sh->disable_deblocking_filter_idc = atoi(value);
-			break;
-		case SLICE_ALPHA_C0_OFFSET_DIV2:
-			sh->slice_alpha_c0_offset_div2 = atoi(value);
-			break;
-		case SLICE_BETA_OFFSET_DIV2:
-			sh->slice_beta_offset_div2 = atoi(value);
-			break;
-		case NUM_REF_IDX_ACTIVE_OVERRIDE_FLAG:
-			sh->num_ref_idx_active_override_flag = atoi(value);
-			assert(sh->num_ref_idx_active_override_flag <= 1);
-			assert(sh->num_ref_idx_active_override_flag >= 0);
-			break;
-		case NUM_REF_IDX_L0_ACTIVE_MINUS1:
-			sh->num_ref_idx_l0_active_minus1 = atoi(value);
-			break;
-		case NUM_REF_IDX_L1_ACTIVE_MINUS1:
-			sh->num_ref_idx_l1_active_minus1 = atoi(value);
-			break;
-		case DIRECT_SPATIAL_MV_PRED_FLAG:
-			sh->direct_spatial_mv_pred_flag = atoi(value);
-			assert(sh->direct_spatial_mv_pred_flag <= 1);
-			assert(sh->direct_spatial_mv_pred_flag >= 0);
-			break;
-		case PIC_ORDER_CNT_LSB:
-			sh->pic_order_cnt_lsb = atoi(value);
-			break;
-		case MACROBLOCKS_NB:
-			sh->macroblocks_nb = atoi(value);
-			break;
+		field = &h264_slice_header_fields[param_id];
+		param = (int *)((char *)sh + field->offset);
+		*param = atoi(value);
+
+		if (field->flag) {
+			assert(*param <= 1);
+			assert(*param >= 0);
 		}
 	}
 
+}
+
+static void add_slice(const struct slice_header *slice)
+{
+	struct slice_header *sh = malloc(sizeof(*sh));
+
+	assert(sh != NULL);
+	*sh = *slice;
+
 	slice_headers = realloc(slice_headers, ++slices_NB * sizeof(void *));
 	assert(slice_headers != NULL);
 
 	slice_headers[slices_NB - 1] = sh;
+}
 
+static void account_slice(const struct slice_header *sh)
+{
 	max_frame_nb = MAX(max_frame_nb, sh->frame_num);
 	max_pic_order_cnt = MAX(max_pic_order_cnt, sh->pic_order_cnt_lsb);
 }
 
+/* Slices file has the --slice sub-options of one slice per line */
+static int read_slice(FILE *fp, struct slice_header *sh)
+{
+	static char *line;
+	static size_t line_size;
+	ssize_t len;
+
+	do {
+		len = getline(&line, &line_size, fp);
+		if (len < 0) {
+			return 0;
+		}
+
+		while (len > 0 && (line[len - 1] == '\n' ||
+				   line[len - 1] == '\r')) {
+			line[--len] = '\0';
+		}
+	} while (len == 0);
+
+	memset(sh, 0, sizeof(*sh));
+	parse_sh_params(sh, line);
+
+	return 1;
+}
+
+/*
+ * Slices of the file follow the --slice ones. In stream mode only their
+ * frame_num and POC ranges are taken here, SPS needs them upfront.
+ */
+static void load_slices_file(void)
+{
+	struct slice_header sh;
+
+	slices_fp = fopen(slices_file_path, "r");
+	if (slices_fp == NULL) {
+		perror(slices_file_path);
+		exit(EXIT_FAILURE);
+	}
+
+	while (read_slice(slices_fp, &sh)) {
+		account_slice(&sh);
+
+		if (!stream_mode) {
+			add_slice(&sh);
+		}
+	}
+
+	if (ferror(slices_fp) != 0) {
+		perror(slices_file_path);
+		exit(EXIT_FAILURE);
+	}
+
+	if (stream_mode) {
+		rewind(slices_fp);
+	} else {
+		fclose(slices_fp);
+		slices_fp = NULL;
+	}
+}
+
+static struct option long_options[] = {
+	{"slice",					required_argument, 0, 0},
+	H264_SYNTAX_LONG_OPTIONS
+	{"REF_IDC",					required_argument, &REF_IDC, 0},
+
+	{"INTER_seed",					required_argument, &INTER_seed, 0},
+	{"INTER_skip_ratio",				required_argument, &INTER_skip_ratio, 0},
+	{"INTER_mvd_range",				required_argument, &INTER_mvd_range, 0},
+	{ /* Sentinel */ }
+};
+
 static void parse_input_params(int argc, char **argv)
 {
 	int c;
 
 	do {
-		struct option long_options[] =
-		{
-			{"slice",					required_argument, 0, 0},
-			{"SPS_profile_idc",				required_argument, &SPS_profile_idc, 0},
-			{"SPS_constraint_set0_flag",			required_argument, &SPS_constraint_set0_flag, 0},
-			{"SPS_constraint_set1_flag",			required_argument, &SPS_constraint_set1_flag, 0},
-			{"SPS_constraint_set2_flag",			required_argument, &SPS_constraint_set2_flag, 0},
-			{"SPS_constraint_set3_flag",			required_argument, &SPS_constraint_set3_flag, 0},
-			{"SPS_constraint_set4_flag",			required_argument, &SPS_constraint_set4_flag, 0},
-			{"SPS_constraint_set5_flag",			required_argument, &SPS_constraint_set5_flag, 0},
-			{"SPS_level_idc",				required_argument, &SPS_level_idc, 0},
-			{"SPS_seq_parameter_set_id",			required_argument, &SPS_seq_parameter_set_id, 0},
-			{"SPS_log2_max_frame_num_minus4",		required_argument, &SPS_log2_max_frame_num_minus4, 0},
-			{"SPS_pic_order_cnt_type",			required_argument, &SPS_pic_order_cnt_type, 0},
-			{"SPS_log2_max_pic_order_cnt_lsb_minus4 ",	required_argument, &SPS_log2_max_pic_order_cnt_lsb_minus4, 0},
-			{"SPS_delta_pic_order_always_zero_flag",	required_argument, &SPS_delta_pic_order_always_zero_flag, 0},
-			{"SPS_offset_for_non_ref_pic",			required_argument, &SPS_offset_for_non_ref_pic, 0},
-			{"SPS_offset_for_top_to_bottom_field",		required_argument, &SPS_offset_for_top_to_bottom_field, 0},
-			{"SPS_num_ref_frames_in_pic_order_cnt_cycle",	required_argument, &SPS_num_ref_frames_in_pic_order_cnt_cycle, 0},
-			{"SPS_offset_for_ref_frame",			required_argument, &SPS_offset_for_ref_frame, 0},
-			{"SPS_max_num_ref_frames",			required_argument, &SPS_max_num_ref_frames, 0},
-			{"SPS_gaps_in_frame_num_value_allowed_flag",	required_argument, &SPS_gaps_in_frame_num_value_allowed_flag, 0},
-			{"SPS_pic_width_in_mbs",			required_argument, &SPS_pic_width_in_mbs, 0},
-			{"SPS_pic_height_in_map_units",			required_argument, &SPS_pic_height_in_map_units, 0},
-			{"SPS_frame_mbs_only_flag",			required_argument, &SPS_frame_mbs_only_flag, 0},
-			{"SPS_mb_adaptive_frame_field_flag",		required_argument, &SPS_mb_adaptive_frame_field_flag, 0},
-			{"SPS_direct_8x8_inference_flag",		required_argument, &SPS_direct_8x8_inference_flag, 0},
-			{"SPS_frame_cropping_flag",			required_argument, &SPS_frame_cropping_flag, 0},
-			{"SPS_frame_crop_left_offset",			required_argument, &SPS_frame_crop_left_offset, 0},
-			{"SPS_frame_crop_right_offset",			required_argument, &SPS_frame_crop_right_offset, 0},
-			{"SPS_frame_crop_top_offset",			required_argument, &SPS_frame_crop_top_offset, 0},
-			{"SPS_frame_crop_bottom_offset",		required_argument, &SPS_frame_crop_bottom_offset, 0},
-			{"SPS_vui_parameters_present_flag",		required_argument, &SPS_vui_parameters_present_flag, 0},
-
-			{"PPS_pic_parameter_set_id",			required_argument, &PPS_pic_parameter_set_id, 0},
-			{"PPS_seq_parameter_set_id",			required_argument, &PPS_seq_parameter_set_id, 0},
-			{"PPS_entropy_coding_mode_flag",		required_argument, &PPS_entropy_coding_mode_flag, 0},
-			{"PPS_bottom_field_pic_order_in_frame_present_flag",required_argument, &PPS_bottom_field_pic_order_in_frame_present_flag, 0},
-			{"PPS_num_slice_groups_minus1",			required_argument, &PPS_num_slice_groups_minus1, 0},
-			{"PPS_num_ref_idx_l0_default_active_minus1",	required_argument, &PPS_num_ref_idx_l0_default_active_minus1, 0},
-			{"PPS_num_ref_idx_l1_default_active_minus1",	required_argument, &PPS_num_ref_idx_l1_default_active_minus1, 0},
-			{"PPS_weighted_pred_flag",			required_argument, &PPS_weighted_pred_flag, 0},
-			{"PPS_weighted_bipred_idc",			required_argument, &PPS_weighted_bipred_idc, 0},
-			{"PPS_pic_init_qp_minus26",			required_argument, &PPS_pic_init_qp_minus26, 0},
-			{"PPS_pic_init_qs_minus26",			required_argument, &PPS_pic_init_qs_minus26, 0},
-			{"PPS_chroma_qp_index_offset",			required_argument, &PPS_chroma_qp_index_offset, 0},
-			{"PPS_deblocking_filter_control_present_flag",	required_argument, &PPS_deblocking_filter_control_present_flag, 0},
-			{"PPS_constrained_intra_pred_flag",		required_argument, &PPS_constrained_intra_pred_flag, 0},
-			{"PPS_redundant_pic_cnt_present_flag",		required_argument, &PPS_redundant_pic_cnt_present_flag, 0},
-			{"PPS_transform_8x8_mode_flag",			required_argument, &PPS_transform_8x8_mode_flag, 0},
-			{"PPS_second_chroma_qp_index_offset",		required_argument, &PPS_second_chroma_qp_index_offset, 0},
-
-			{"REF_IDC",					required_argument, &REF_IDC, 0},
-			{ /* Sentinel */ }
-		};
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "o:d:", long_options, &option_index);
+		c = getopt_long(argc, argv, "o:d:t:p:sS:", long_options, &option_index);
 
 		switch (c) {
 		case 0:
 			if (option_index == 0) {
-				parse_sh_params();
+				struct slice_header sh = { 0 };
+
+				parse_sh_params(&sh, optarg);
+				account_slice(&sh);
+				add_slice(&sh);
 			} else {
 				*long_options[option_index].flag = atoi(optarg);
 			}
@@ -739,6 +853,18 @@ static void parse_input_params(int argc, char **argv)
 		case 'd':
 			misc_out_dir = optarg;
 			break;
+		case 't':
+			tpl_out_path = optarg;
+			break;
+		case 'p':
+			tpl_in_path = optarg;
+			break;
+		case 's':
+			stream_mode = 1;
+			break;
+		case 'S':
+			slices_file_path = optarg;
+			break;
 		default:
 			abort();
 		}
@@ -752,18 +878,295 @@ static void parse_input_params(int argc, char **argv)
 	if (misc_out_dir == NULL) {
 		fprintf(stderr, "-d misc output directory path [optional]\n");
 	}
+
+	if (stream_mode && (tpl_out_path != NULL || tpl_in_path != NULL)) {
+		fprintf(stderr, "-s stream mode can't be used with templates\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (slices_file_path != NULL) {
+		load_slices_file();
+	}
+}
+
+/*
+ * Parameters the stream is generated from: value of every option in the
+ * long_options order, then slices_NB and the slice headers.
+ */
+static int * params_snapshot(uint32_t *params_nb)
+{
+	int opts_nb = ARRAY_SIZE(long_options) - 2;
+	int sh_ints = sizeof(struct slice_header) / sizeof(int);
+	int *params;
+	int i, n = 0;
+
+	*params_nb = opts_nb + 3 + slices_NB * sh_ints;
+
+	params = malloc(*params_nb * sizeof(*params));
+	assert(params != NULL);
+
+	params[n++] = opts_nb;
+
+	for (i = 1; i <= opts_nb; i++) {
+		params[n++] = *long_options[i].flag;
+	}
+
+	params[n++] = slices_NB;
+	params[n++] = sh_ints;
+
+	for (i = 0; i < slices_NB; i++) {
+		memcpy(&params[n], slice_headers[i], sizeof(struct slice_header));
+		n += sh_ints;
+	}
+
+	return params;
+}
+
+static int is_slice_dep(const int *flag)
+{
+	unsigned i;
+
+	for (i = 0; h264_slice_header_deps[i] != NULL; i++) {
+		if (h264_slice_header_deps[i] == flag) {
+			return 1;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(slice_data_deps); i++) {
+		if (slice_data_deps[i] == flag) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void log_elem(FILE *f, const struct h264_tpl_elem *elem)
+{
+	uint32_t i;
+
+	for (i = 0; i < elem->count; i++) {
+		if (elem->coding == H264_TPL_SE) {
+			fprintf(f, "%s = %d\n", elem->name,
+				(int32_t)elem->value);
+		} else {
+			fprintf(f, "%s = %u\n", elem->name, elem->value);
+		}
+	}
+
+	if (ferror(f) != 0) {
+		perror("");
+	}
+
+	assert(ferror(f) == 0);
+}
+
+/* Same misc output as the generate_*() functions produce */
+static void write_misc_files(const struct h264_tpl *tpl)
+{
+	const struct h264_tpl_nal *nal;
+	uint32_t first, last, i, k;
+	char name[32];
+	int slice_id = 0;
+	FILE *f;
+
+	for (i = 0; i < tpl->nals_nb; i++) {
+		nal = &tpl->nals[i];
+
+		switch (nal->header & 0x1F) {
+		case 7:
+			strcpy(name, "SPS");
+			break;
+		case 8:
+			strcpy(name, "PPS");
+			break;
+		case 1:
+		case 5:
+			sprintf(name, "slice_%d", slice_id++);
+			break;
+		default:
+			continue;
+		}
+
+		f = open_file( misc_path("%s.txt", name) );
+
+		for (k = 0; f != NULL && k < nal->elems_nb; k++) {
+			log_elem(f, &nal->elems[k]);
+		}
+
+		if (f) {
+			fclose(f);
+		}
+
+		h264_tpl_nal_span(tpl, i, &first, &last);
+		write_bitstream_to_file(misc_path("%s.data", name), first,
+					last - first + 1);
+	}
+}
+
+/*
+ * Produces the stream from the base template. Only NALs whose parameters
+ * differ from the base ones are dry-run to collect their elements, those
+ * get patched and the rest is copied.
+ */
+static void patch_h264(const struct h264_tpl *base)
+{
+	int opts_nb = ARRAY_SIZE(long_options) - 2;
+	int sh_ints = sizeof(struct slice_header) / sizeof(int);
+	const int *base_sh = base->params + opts_nb + 3;
+	int sps_changed = 0, pps_changed = 0, deps_changed = 0;
+	int base_slices_nb = 0;
+	struct h264_tpl tpl;
+	uint32_t params_nb;
+	int *params;
+	int i;
+
+	derive_parameters();
+
+	params = params_snapshot(&params_nb);
+
+	if (base->params_nb >= (uint32_t)opts_nb + 3 &&
+	    base->params[0] == opts_nb &&
+	    base->params[opts_nb + 2] == sh_ints) {
+		base_slices_nb = base->params[opts_nb + 1];
+	}
+
+	if (base_slices_nb <= 0 ||
+	    base->nals_nb != (uint32_t)base_slices_nb + 3 ||
+	    base->params_nb != (uint32_t)(opts_nb + 3) +
+			       (uint32_t)base_slices_nb * sh_ints) {
+		sps_changed = pps_changed = deps_changed = 1;
+		base_slices_nb = 0;
+	}
+
+	for (i = 1; i <= opts_nb && base_slices_nb; i++) {
+		if (params[i] == base->params[i]) {
+			continue;
+		}
+
+		if (strncmp(long_options[i].name, "SPS_", 4) == 0) {
+			sps_changed = 1;
+		} else if (strncmp(long_options[i].name, "PPS_", 4) == 0) {
+			pps_changed = 1;
+		} else if (strncmp(long_options[i].name, "INTER_", 6) == 0) {
+			deps_changed = 1;
+		} else {
+			sps_changed = pps_changed = deps_changed = 1;
+		}
+
+		if (is_slice_dep(long_options[i].flag)) {
+			deps_changed = 1;
+		}
+	}
+
+	h264_tpl_init(&tpl, 0);
+	tpl_rec = &tpl;
+	dry_run = 1;
+
+	if (sps_changed) {
+		generate_SPS();
+	} else {
+		h264_tpl_nal_reuse(&tpl, 0);
+	}
+
+	if (pps_changed) {
+		generate_PPS();
+	} else {
+		h264_tpl_nal_reuse(&tpl, 1);
+	}
+
+	for (i = 0; i < slices_NB; i++) {
+		if (deps_changed || i >= base_slices_nb ||
+		    memcmp(slice_headers[i], base_sh + i * sh_ints,
+			   sizeof(struct slice_header)) != 0) {
+			generate_slice(slice_headers[i], i);
+		} else {
+			h264_tpl_nal_reuse(&tpl, i + 2);
+		}
+	}
+
+	generate_NAL_header(REF_IDC, 11); // End of stream
+
+	dry_run = 0;
+	tpl_rec = NULL;
+
+	h264_tpl_patch(&tpl, base);
+
+	writer.data_ptr = tpl.stream;
+	writer.data_cnt = tpl.stream_size;
+
+	write_misc_files(&tpl);
+	write_bitstream_to_file(h264_out_file_path, 0, writer.data_cnt + 1);
+
+	if (tpl_out_path != NULL) {
+		h264_tpl_set_params(&tpl, params, params_nb);
+		h264_tpl_write(&tpl, tpl_out_path);
+	}
+
+	writer.data_ptr = NULL;
+	h264_tpl_free(&tpl);
+	free(params);
 }
 
 int main(int argc, char **argv)
 {
+	struct h264_tpl tpl;
+	uint32_t params_nb;
+	int *params;
+
 	parse_input_params(argc, argv);
 
+	if (tpl_in_path != NULL) {
+		if (h264_tpl_read(&tpl, tpl_in_path) == 0) {
+			patch_h264(&tpl);
+			h264_tpl_free(&tpl);
+			goto done;
+		}
+
+		fprintf(stderr, "%s: Template is unusable, generating "
+			"from scratch\n", tpl_in_path);
+	}
+
 	bitstream_init(&writer);
 
+	if (tpl_out_path != NULL) {
+		h264_tpl_init(&tpl, 1);
+		tpl_rec = &tpl;
+	}
+
+	if (stream_mode) {
+		stream_fp = fopen(h264_out_file_path, "w+");
+		if (stream_fp == NULL) {
+			perror(h264_out_file_path);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	generate_h264();
 
-	write_bitstream_to_file(h264_out_file_path, 0, writer.data_cnt + 1);
+	if (stream_fp != NULL) {
+		fwrite(writer.data_ptr, 1, writer.data_cnt + 1, stream_fp);
 
+		if (ferror(stream_fp) != 0 || fclose(stream_fp) != 0) {
+			perror(h264_out_file_path);
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		write_bitstream_to_file(h264_out_file_path, 0,
+					writer.data_cnt + 1);
+	}
+
+	if (tpl_out_path != NULL) {
+		params = params_snapshot(&params_nb);
+
+		h264_tpl_finish(&tpl, writer.data_ptr, writer.data_cnt,
+				writer.track_escape_seq);
+		h264_tpl_set_params(&tpl, params, params_nb);
+		h264_tpl_write(&tpl, tpl_out_path);
+		h264_tpl_free(&tpl);
+		free(params);
+	}
+done:
 	printf("H.264 bitstream generation completed!\n");
 
 	return 0;
@@ -0,0 +1,108 @@
+#!/usr/bin/perl
+
+# Writes a synthetic but deterministic raw IO trace for the offline
+# benchmark: frames are framed by the RST_DEV_H_SET write and the SXE
+# interrupt like the recorded ones, with the engines registers accesses,
+# memset-able DRAM runs and the BSEV end of frame marker in between.
+#
+# Usage: mk_sample_trace.pl out.bin [frames_nb] [seed]
+
+use strict;
+use warnings;
+
+my ($out, $frames_nb, $seed) = @ARGV;
+
+die "Usage: $0 out.bin [frames_nb] [seed]\n" if (!defined($out));
+
+$frames_nb //= 300;
+$seed //= 1;
+
+# Own LCG, rand() sequence differs across perl builds. The low bits of a
+# power of two modulus LCG have short periods, the bit 0 just alternates,
+# so only the 15 high ones are used and wider values take two steps.
+my $state = $seed & 0xFFFFFFFF;
+
+sub lcg {
+    $state = ($state * 1103515245 + 12345) & 0x7FFFFFFF;
+
+    return $state >> 16;
+}
+
+sub rnd {
+    my $max = shift;
+    my $v = lcg();
+
+    $v = ($v << 15) | lcg() if ($max > 1 << 15);
+    $v = ($v << 15) | lcg() if ($max > 1 << 30);
+
+    return $v % $max;
+}
+
+open(my $fh, '>', $out) or die "$out: $!\n";
+binmode $fh;
+
+print $fh pack('N', 20151226);
+
+my $buf = '';
+
+# src: 0 CPU, 1 AVP; type: 0 IRQ, 1 READ32, 2 WRITE32, 6 READ16, 7 WRITE16
+sub rec {
+    $buf .= pack('CNNN', @_);
+}
+
+my @engines = (0x6001A000, 0x6001B000, 0x6001C000, 0x6001C200, 0x6001C400,
+               0x6001C600, 0x6001C800, 0x6001CA00, 0x6001D800);
+
+for my $fn (0 .. $frames_nb - 1) {
+    rec(0, 2, 0x60006308, 0x20000000);
+    rec(0, 2, 0x6000630C, 0x20000000);
+
+    # Frame buffers clearing, merged into memsets by the converter
+    my $dram = 0x01000000 + ($fn % 64) * 0x40000;
+
+    for my $run (0 .. 3 + rnd(4)) {
+        my $val = rnd(4) ? 0 : 0x80808080;
+        my $src = rnd(2);
+
+        rec($src, 2, $dram + $_ * 4, $val) for 0 .. 64 + rnd(512);
+        $dram += 0x8000;
+    }
+
+    for my $FID (0 .. 2) {
+        rec(1, 2, 0x6001D800 + $FID * 4,
+            0x02000000 + (($fn + $FID) % 4) * 0x100000);
+    }
+
+    rec(1, 2, 0x40000000 + $_ * 4, 0xDEAD0000 + $_) for 0 .. 7;
+
+    for (0 .. 200 + rnd(400)) {
+        my $engine = $engines[rnd(scalar(@engines))];
+        my $reg = $engine + rnd(128) * 4;
+
+        if (rnd(3)) {
+            rec(1, 2, $reg, rnd(0x7FFFFFFF));
+        } else {
+            rec(1, 1, $reg, rnd(0x10000));
+        }
+    }
+
+    # BSEV busy polling
+    rec(1, 1, 0x6001A004, 0) for 0 .. rnd(30);
+    rec(1, 1, 0x6001A004, 1);
+    rec(1, 6, 0x6001C400 + rnd(64) * 2, rnd(0x10000));
+    rec(1, 7, 0x6001C600 + rnd(64) * 2, rnd(0x10000));
+    rec(0, 0, 17, 1);
+    # Frames without the BSEV trailer write aren't trimmed by split.pl
+    rec(1, 2, 0x6001B08C, 1) if ($fn % 8 != 7);
+    rec(1, 2, 0x6001C400, $fn);
+    rec(1, 0, 12, 1);
+    rec(0, 1, 0x6001B018, 0x10);
+
+    if (length($buf) > 1 << 20) {
+        print $fh $buf;
+        $buf = '';
+    }
+}
+
+print $fh $buf;
+close($fh) or die "$out: $!\n";
@@ -0,0 +1,327 @@
+#!/usr/bin/perl
+
+# Delta debugging of h264_test_generator parameters: given a passing and a
+# failing parameter set, finds a minimal subset of their differences that
+# still makes the passing set fail.
+#
+# Differences are the global options and the slice sub-options that differ
+# (slices are matched by position, surplus slices are differences on their
+# own). Candidates are probed with the oracle command, which gets the
+# parameters as its last argument and exits with 0 on pass, 125 if the
+# probe can't be judged (bad combination, capture failure) and anything
+# else on failure. Probes of a round run in parallel, pass and fail
+# verdicts are cached by the canonical parameters across runs. Unresolved
+# ones aren't, they may come from a transient hardware or capture problem
+# and are probed again.
+#
+# Usage: reduce.pl [-j jobs] [-o oracle] [-c cache_file] 'passing' 'failing'
+
+use strict;
+use warnings;
+
+use Digest::SHA qw(sha256_hex);
+use File::Basename;
+use File::Path qw(make_path);
+use POSIX qw(:sys_wait_h);
+
+require(dirname(__FILE__) . '/canon_params.pl');
+
+my %opts;
+
+# Not getopts, the parameter sets start with dashes themselves
+while (@ARGV > 2 && $ARGV[0] =~ /^-([joc])$/) {
+    shift;
+    $opts{$1} = shift;
+}
+
+@ARGV == 2
+    or die "Usage: $0 [-j jobs] [-o oracle] [-c cache_file] 'passing' 'failing'\n" .
+           "\t-j parallel probes (default 4)\n" .
+           "\t-o oracle command (default './run_test.sh --probe')\n" .
+           "\t-c verdicts cache (default ~/.cache/Tegra2VDE-reTool/reduce.cache)\n";
+
+my $jobs = $opts{j} // 4;
+my $oracle = $opts{o} // './run_test.sh --probe';
+my $cache_path = $opts{c} //
+    "$ENV{HOME}/.cache/Tegra2VDE-reTool/reduce.cache";
+
+my %cache;
+my $probes_nb = 0;
+my $cached_nb = 0;
+
+sub cache_key {
+    return sha256_hex("$oracle\n" . params_key(shift));
+}
+
+sub cache_load {
+    open(my $fh, '<', $cache_path) or return;
+
+    while (<$fh>) {
+        my ($key, $verdict) = split;
+        $cache{$key} = $verdict if (defined($verdict) &&
+                                    $verdict =~ /^(pass|fail)$/);
+    }
+
+    close($fh);
+}
+
+sub cache_store {
+    my ($key, $verdict) = @_;
+
+    return if ($verdict eq 'unresolved');
+
+    $cache{$key} = $verdict;
+
+    make_path(dirname($cache_path));
+    open(my $fh, '>>', $cache_path) or return;
+    print $fh "$key $verdict\n";
+    close($fh);
+}
+
+sub parse_slice {
+    my %sh = map { split(/=/, $_, 2) } split(/,/, shift);
+
+    return \%sh;
+}
+
+sub params_string {
+    my ($opts, $slices) = @_;
+    my @args = map { opt_string($_, $opts->{$_}) } sort keys %$opts;
+
+    foreach my $sh (@$slices) {
+        push @args, '--slice=' . join(',', map { "$_=$sh->{$_}" } sort keys %$sh);
+    }
+
+    return join(' ', @args);
+}
+
+my ($pass_opts, $pass_slices) = parse_params($ARGV[0]);
+my ($fail_opts, $fail_slices) = parse_params($ARGV[1]);
+
+@$pass_slices = map { parse_slice($_) } @$pass_slices;
+@$fail_slices = map { parse_slice($_) } @$fail_slices;
+
+# Differences: [ 'opt', name ], [ 'sub', slice, name ], [ 'add', slice ]
+# and [ 'del', slice ]
+my @diffs;
+
+sub differs {
+    my ($a, $b) = @_;
+
+    return defined($a) != defined($b) || (defined($a) && $a ne $b);
+}
+
+foreach my $name (sort keys %{{ %$pass_opts, %$fail_opts }}) {
+    push @diffs, [ 'opt', $name ]
+        if (differs($pass_opts->{$name}, $fail_opts->{$name}));
+}
+
+for (my $i = 0; $i < @$pass_slices || $i < @$fail_slices; $i++) {
+    if ($i >= @$fail_slices) {
+        push @diffs, [ 'del', $i ];
+        next;
+    }
+
+    if ($i >= @$pass_slices) {
+        push @diffs, [ 'add', $i ];
+        next;
+    }
+
+    my ($p, $f) = ($pass_slices->[$i], $fail_slices->[$i]);
+
+    foreach my $name (sort keys %{{ %$p, %$f }}) {
+        push @diffs, [ 'sub', $i, $name ] if (differs($p->{$name}, $f->{$name}));
+    }
+}
+
+# Flag options like -s have an empty value
+sub opt_value {
+    my $val = shift;
+
+    return !defined($val) ? 'unset' : $val eq '' ? 'set' : $val;
+}
+
+sub diff_string {
+    my $d = shift;
+    my ($kind, $i, $name) = @$d;
+
+    return $kind eq 'opt' ? ($i =~ /^-/ ? $i : "--$i") . ': ' .
+                            opt_value($pass_opts->{$i}) . ' -> ' .
+                            opt_value($fail_opts->{$i}) :
+           $kind eq 'sub' ? "slice $i $name: " .
+                            ($pass_slices->[$i]{$name} // 'unset') . ' -> ' .
+                            ($fail_slices->[$i]{$name} // 'unset') :
+           $kind eq 'add' ? "slice $i added" : "slice $i removed";
+}
+
+# Passing parameters with the given differences applied
+sub apply {
+    my %opts = %$pass_opts;
+    my @slices = map { +{ %$_ } } @$pass_slices;
+    my %drop;
+
+    foreach my $d (map { $diffs[$_] } @_) {
+        my ($kind, $i, $name) = @$d;
+
+        if ($kind eq 'opt') {
+            if (defined($fail_opts->{$i})) {
+                $opts{$i} = $fail_opts->{$i};
+            } else {
+                delete $opts{$i};
+            }
+        } elsif ($kind eq 'sub') {
+            if (defined($fail_slices->[$i]{$name})) {
+                $slices[$i]{$name} = $fail_slices->[$i]{$name};
+            } else {
+                delete $slices[$i]{$name};
+            }
+        } elsif ($kind eq 'del') {
+            $drop{$i} = 1;
+        } else {
+            $slices[$i] = { %{$fail_slices->[$i]} };
+        }
+    }
+
+    @slices = map { $slices[$_] } grep { !$drop{$_} && defined($slices[$_]) }
+                  0 .. $#slices;
+
+    return canon_params(params_string(\%opts, \@slices));
+}
+
+sub verdict {
+    my $status = shift;
+
+    return 'pass' if ($status == 0);
+    return 'unresolved' if (($status >> 8) == 125);
+    return 'fail';
+}
+
+# Probes the parameter sets with up to $jobs oracles at once. Stops
+# launching new probes once the first failure in the list order is known,
+# returns the verdicts (undef for the ones not probed).
+sub probe {
+    my @params = @_;
+    my @verdicts;
+    my %running;
+    my $next = 0;
+
+    my $first_fail = sub {
+        foreach my $i (0 .. $#params) {
+            return undef if (!defined($verdicts[$i]));
+            return $i if ($verdicts[$i] eq 'fail');
+        }
+        return undef;
+    };
+
+    while (1) {
+        while ($next < @params && keys(%running) < $jobs &&
+               !defined($first_fail->())) {
+            my $i = $next++;
+            my $key = cache_key($params[$i]);
+
+            if (defined($cache{$key})) {
+                $verdicts[$i] = $cache{$key};
+                $cached_nb++;
+                print STDERR "cached $cache{$key}: $params[$i]\n";
+                next;
+            }
+
+            my $pid = fork();
+            die "fork: $!\n" if (!defined($pid));
+
+            if ($pid == 0) {
+                open(STDOUT, '>', '/dev/null');
+                open(STDERR, '>', '/dev/null');
+                exec('/bin/sh', '-c', "$oracle \"\$1\"", 'sh', $params[$i]);
+                exit(127);
+            }
+
+            $running{$pid} = $i;
+            $probes_nb++;
+        }
+
+        last if (!%running);
+
+        my $pid = waitpid(-1, 0);
+        my $i = delete $running{$pid};
+
+        next if (!defined($i));
+
+        $verdicts[$i] = verdict($?);
+        cache_store(cache_key($params[$i]), $verdicts[$i]);
+        print STDERR "probed $verdicts[$i]: $params[$i]\n";
+    }
+
+    return @verdicts;
+}
+
+sub split_parts {
+    my ($c, $n) = @_;
+    my @parts;
+    my $start = 0;
+
+    foreach my $i (0 .. $n - 1) {
+        my $end = int(@$c * ($i + 1) / $n);
+        push @parts, [ @$c[$start .. $end - 1] ];
+        $start = $end;
+    }
+
+    return @parts;
+}
+
+# ddmin: subsets first, then complements, then finer granularity
+sub ddmin {
+    my @c = @_;
+    my $n = 2;
+
+    while (@c > 1) {
+        my @subsets = split_parts(\@c, $n);
+        my @complements;
+
+        foreach my $part (@subsets) {
+            my %in = map { $_ => 1 } @$part;
+            push @complements, [ grep { !$in{$_} } @c ];
+        }
+
+        # With two parts the complements are the subsets
+        @complements = () if ($n == 2);
+
+        my @cands = (@subsets, @complements);
+        my @verdicts = probe(map { apply(@$_) } @cands);
+        my ($hit) = grep { ($verdicts[$_] // '') eq 'fail' } 0 .. $#cands;
+
+        if (defined($hit) && $hit < @subsets) {
+            @c = @{$cands[$hit]};
+            $n = 2;
+        } elsif (defined($hit)) {
+            @c = @{$cands[$hit]};
+            $n = $n - 1 > 2 ? $n - 1 : 2;
+        } elsif ($n < @c) {
+            $n = $n * 2 < @c ? $n * 2 : scalar(@c);
+        } else {
+            last;
+        }
+    }
+
+    return @c;
+}
+
+die "Parameter sets don't differ\n" if (!@diffs);
+
+cache_load();
+
+print STDERR scalar(@diffs), " differences\n";
+
+my ($pass_verdict, $fail_verdict) = probe(apply(), apply(0 .. $#diffs));
+
+die "Passing parameters don't pass ($pass_verdict)\n"
+    if ($pass_verdict ne 'pass');
+die "Failing parameters don't fail (" . ($fail_verdict // 'not probed') . ")\n"
+    if (($fail_verdict // '') ne 'fail');
+
+my @min = ddmin(0 .. $#diffs);
+
+print STDERR "$probes_nb probes, $cached_nb cached\n";
+print "Minimal failure-inducing differences:\n";
+print "\t", diff_string($diffs[$_]), "\n" foreach (@min);
+print "Failing parameters:\n\t", apply(@min), "\n";
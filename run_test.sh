@@ -3,35 +3,143 @@
 # Set the paths here
 LOGS_DIR="/home/dima/vl/logs/VDE_logs"
 REMOTE_ROOT="/home/dima/vl/nfs_root/android"
+CACHE_DIR="$HOME/.cache/Tegra2VDE-reTool"
+CACHE_MAX_MB=4096
+
+# trace_query filter applied to the logs shown in meld, e.g. "engine=MBE",
+# the frame markers are kept so that the filtered log still gets split
+TRACE_FILTER=""
+
+# Probe verdict (see reduce.pl): the decoded picture must be that close to
+# the ffmpeg decoding of the same stream, PROBE_CHECK replaces the check
+# with a command that gets the run directory.
+PROBE_PSNR_MIN=30
+PROBE_CHECK=""
 
 DATE=$(date +"%d.%m_%H:%M:%S")
 LOCK_FILE=$0
 RUNS=0
+CACHE_LOG="$LOGS_DIR/$DATE/cache.log"
 
 prepare() {
 	adb connect localhost || exit $?
 }
 
+hash_file() {
+	sha256sum "$1" | cut -d' ' -f1
+}
+
+hash_str() {
+	echo -n "$1" | sha256sum | cut -d' ' -f1
+}
+
+# Content-addressed cache: entries are "$CACHE_DIR/<kind>/<key>/", the
+# entry directory mtime is bumped on every hit for the LRU eviction.
+cache_lookup() {
+	local entry="$CACHE_DIR/$1/$2"
+
+	if [ -d "$entry" ]; then
+		touch "$entry"
+		echo "hit $1 $2" >> "$CACHE_LOG"
+		echo "$entry"
+		return 0
+	fi
+
+	echo "miss $1 $2" >> "$CACHE_LOG"
+	return 1
+}
+
+cache_store() {
+	local kind="$1"
+	local entry="$CACHE_DIR/$1/$2"
+	local tmp
+
+	shift 2
+
+	mkdir -p "$CACHE_DIR/$kind" || return
+	tmp=$(mktemp -d "$CACHE_DIR/$kind/.tmp.XXXXXX") || return
+
+	# Parallel runs may race for the same key, the first one wins
+	cp -a "$@" "$tmp/" && mv -T "$tmp" "$entry" 2>/dev/null || rm -rf "$tmp"
+}
+
+cache_evict() {
+	local size stamp entry
+
+	[ -d "$CACHE_DIR" ] || return
+
+	size=$(du -sk "$CACHE_DIR" | cut -f1)
+
+	find "$CACHE_DIR" -mindepth 2 -maxdepth 2 -type d ! -name '.tmp.*' \
+		-printf '%T@ %p\n' | sort -n |
+	while read -r stamp entry; do
+		[ "$size" -le "$((CACHE_MAX_MB * 1024))" ] && break
+		size=$((size - $(du -sk "$entry" | cut -f1)))
+		rm -rf "$entry"
+		echo "evict $entry" >> "$CACHE_LOG"
+	done
+}
+
+cache_report() {
+	[ -f "$CACHE_LOG" ] || return
+
+	awk '$1 == "hit" || $1 == "miss" { cnt[$2, $1]++; kinds[$2] }
+	     $1 == "evict" { evicted++ }
+	     END {
+		for (kind in kinds)
+			printf "cache %-6s %d hits %d misses\n", kind,
+				cnt[kind, "hit"], cnt[kind, "miss"]
+		if (evicted)
+			printf "cache evicted %d entries\n", evicted
+	     }' "$CACHE_LOG"
+}
+
 filter() {
-	cat "$1" > "$1.filtered"
+	if [ -n "$TRACE_FILTER" ]; then
+		./trace_query -m "$2" "$TRACE_FILTER" > "$1.filtered" || exit $?
+	else
+		cat "$1" > "$1.filtered"
+	fi
+
 	echo "$1.filtered"
 }
 
 process_log() {
-	./bin_to_txt.pl "$1" "$2" || exit $?
+	local trace="$4/$(basename "$1")"
+	local key entry
+
+	key=$(hash_str "$(hash_file "$1") $(hash_file ./trace_to_txt)")
+
+	if entry=$(cache_lookup trace "$key"); then
+		cp "$entry/"*.txt "$2" || exit $?
+		cp "$entry/"*.idx "$trace.idx" || exit $?
+	else
+		./trace_to_txt -i "$trace.idx" "$1" "$2" || exit $?
+		cache_store trace "$key" "$2" "$trace.idx"
+	fi
 
 	cp "$1" "$4/" || exit $?
 
 	echo -e "$3\n" > "$2.processed"
 	echo -e "$3\n" > "$4/dmesg.cleaned.txt"
 
-	cat "$(filter $2)" >> "$2.processed"
+	cat "$(filter "$2" "$trace")" >> "$2.processed"
 	./split.pl "$2.filtered"
 
 	perl -pe 's/^<\d>\[[ \d]+\.[\d ]+\] //g' "$4/dmesg.txt" >> "$4/dmesg.cleaned.txt"
 	./split.pl "$4/dmesg.cleaned.txt"
 
-	./mk_graph.pl "$2.processed" "$4/graph.png"
+	# Kernel log and IO trace interleaved on the frame markers
+	./trace_merge -o "$4/merged.txt" "$4/dmesg.txt" "$1" || exit $?
+
+	key=$(hash_str "$(hash_file "$2.processed") $(hash_file ./mk_graph.pl)")
+
+	if entry=$(cache_lookup graph "$key"); then
+		cp "$entry/graph.png" "$4/graph.png"
+	else
+		./mk_graph.pl "$2.processed" "$4/graph.png" &&
+		cache_store graph "$key" "$4/graph.png"
+	fi
 }
 
 join_and_show_diff() {
@@ -42,19 +150,25 @@ join_and_show_diff() {
 		wait $job || ((LOG_PROCESS_FAIL++))
 	done
 
+	cache_evict
+	cache_report
+
 	[ "$LOG_PROCESS_FAIL" == "0" ] || exit $LOG_PROCESS_FAIL
 
 	echo "running \`meld \"$LOGS_DIR/$DATE/\"*/io_trace*.txt.processed\`"
 	echo "running \`meld \"$LOGS_DIR/$DATE/\"*/dmesg.cleaned.txt\`"
+	echo "running \`meld \"$LOGS_DIR/$DATE/\"*/merged.txt\`"
 
 	meld "$LOGS_DIR/$DATE/"*/io_trace*.txt.processed &
 	meld "$LOGS_DIR/$DATE/"*/dmesg.cleaned.txt &
+	meld "$LOGS_DIR/$DATE/"*/merged.txt &
 }
 
 run_test_on_remote() {
 	cp "$1/test.mp4" "$REMOTE_ROOT/data/media/" || exit $?
 	adb logcat -c
 	adb shell busybox dmesg -c > /dev/null
+	rm -f "$REMOTE_ROOT/storage/sdcard0/out.jpg"
 	adb shell stagefright -r "/data/media/test.mp4"
 	adb shell busybox dmesg -c > "$1/dmesg.txt"
 	adb logcat -d > "$1/logcat.txt"
@@ -104,10 +218,24 @@ collect_trace_log() {
 }
 
 generate_test_file() {
+	local canon key entry files
+
 	echo "$2" > "$1/params.txt"
-	./h264_test_generator -o "$1/test.h264" -d "$1" $2 || exit $?
-	ffmpeg -loglevel debug -r 5 -i "$1/test.h264" -vcodec copy -y "$1/test.mp4"
-	mpv --speed=10 "$1/test.mp4"
+
+	canon=$(./canon_params.pl --key $2) || exit $?
+	key=$(hash_str "$canon $(hash_file ./h264_test_generator)")
+
+	if entry=$(cache_lookup gen "$key"); then
+		cp -a "$entry/." "$1/" || exit $?
+	else
+		./h264_test_generator -o "$1/test.h264" -d "$1" $2 || exit $?
+		ffmpeg -loglevel debug -r 5 -i "$1/test.h264" -vcodec copy -y "$1/test.mp4" || exit $?
+
+		mapfile -t files < <(find "$1" -mindepth 1 -maxdepth 1 ! -name params.txt)
+		cache_store gen "$key" "${files[@]}"
+	fi
+
+	[ -n "$PROBE" ] || mpv --speed=10 "$1/test.mp4"
 }
 
 run_it() {
@@ -122,6 +250,49 @@ run_test() {
 	(((RUNS++)))
 }
 
+probe_check() {
+	local psnr
+
+	if [ -n "$PROBE_CHECK" ]; then
+		$PROBE_CHECK "$1"
+		return
+	fi
+
+	[ -f "$1/out.jpg" ] || return 1
+
+	ffmpeg -loglevel error -i "$1/test.h264" -frames:v 1 -y "$1/ref.png" ||
+		return 125
+
+	psnr=$(ffmpeg -i "$1/out.jpg" -i "$1/ref.png" -lavfi psnr -f null - 2>&1 |
+	       sed -n 's/.* average:\([0-9.inf]*\).*/\1/p')
+
+	echo "psnr $psnr" > "$1/verdict.txt"
+
+	[ -n "$psnr" ] || return 125
+	[ "$psnr" == "inf" ] && return 0
+
+	awk -v psnr="$psnr" -v min="$PROBE_PSNR_MIN" 'BEGIN { exit !(psnr >= min) }'
+}
+
+# One generate and capture run judged by probe_check: exits with 0 on pass,
+# 1 on failure and 125 if the run itself failed, the way reduce.pl expects.
+probe() {
+	local dir="$LOGS_DIR/$DATE/probe.$$"
+
+	mkdir -p "$dir" || exit 125
+
+	(PROBE=1 generate_test_file "$dir" "$1") || exit 125
+	collect_trace_log "$dir" > "$dir/trace_path.txt" || exit 125
+
+	probe_check "$dir"
+	exit $?
+}
+
+if [ "$1" == "--probe" ]; then
+	(prepare) || exit 125
+	probe "$2"
+fi
+
 prepare
 
 # Add tests here:
@@ -0,0 +1,855 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "trace.h"
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+#define CONNECT_RETRIES		50
+
+struct reg_name {
+	uint32_t addr;
+	const char *name;
+};
+
+struct block_range {
+	uint32_t start;
+	uint32_t end;
+	int block;
+	const char *name;
+};
+
+/* Sorted by address, keep in sync with bin_to_txt.pl */
+static const struct reg_name reg_names[] = {
+	{ 0x60006000, "CLK_RST_CONTROLLER_RST_SOURCE_0" },
+	{ 0x60006004, "CLK_RST_CONTROLLER_RST_DEVICES_L_0" },
+	{ 0x60006008, "CLK_RST_CONTROLLER_RST_DEVICES_H_0" },
+	{ 0x6000600C, "CLK_RST_CONTROLLER_RST_DEVICES_U_0" },
+	{ 0x60006010, "CLK_RST_CONTROLLER_CLK_OUT_ENB_L_0" },
+	{ 0x60006014, "CLK_RST_CONTROLLER_CLK_OUT_ENB_H_0" },
+	{ 0x60006018, "CLK_RST_CONTROLLER_CLK_OUT_ENB_U_0" },
+	{ 0x60006020, "CLK_RST_CONTROLLER_CCLK_BURST_POLICY_0" },
+	{ 0x60006024, "CLK_RST_CONTROLLER_SUPER_CCLK_DIVIDER_0" },
+	{ 0x60006028, "CLK_RST_CONTROLLER_SCLK_BURST_POLICY_0" },
+	{ 0x6000602C, "CLK_RST_CONTROLLER_SUPER_SCLK_DIVIDER_0" },
+	{ 0x60006030, "CLK_RST_CONTROLLER_CLK_SYSTEM_RATE_0" },
+	{ 0x60006034, "CLK_RST_CONTROLLER_PROG_DLY_CLK_0" },
+	{ 0x60006038, "CLK_RST_CONTROLLER_AUDIO_SYNC_CLK_RATE_0" },
+	{ 0x60006040, "CLK_RST_CONTROLLER_COP_CLK_SKIP_POLICY_0" },
+	{ 0x60006044, "CLK_RST_CONTROLLER_CLK_MASK_ARM_0" },
+	{ 0x60006048, "CLK_RST_CONTROLLER_MISC_CLK_ENB_0" },
+	{ 0x6000604C, "CLK_RST_CONTROLLER_CLK_CPU_CMPLX_0" },
+	{ 0x60006050, "CLK_RST_CONTROLLER_OSC_CTRL_0" },
+	{ 0x60006054, "CLK_RST_CONTROLLER_PLL_LFSR_0" },
+	{ 0x60006058, "CLK_RST_CONTROLLER_OSC_FREQ_DET_0" },
+	{ 0x6000605C, "CLK_RST_CONTROLLER_OSC_FREQ_DET_STATUS_0" },
+	{ 0x60006080, "CLK_RST_CONTROLLER_PLLC_BASE_0" },
+	{ 0x60006084, "CLK_RST_CONTROLLER_PLLC_OUT_0" },
+	{ 0x6000608C, "CLK_RST_CONTROLLER_PLLC_MISC_0" },
+	{ 0x60006090, "CLK_RST_CONTROLLER_PLLM_BASE_0" },
+	{ 0x60006094, "CLK_RST_CONTROLLER_PLLM_OUT_0" },
+	{ 0x6000609C, "CLK_RST_CONTROLLER_PLLM_MISC_0" },
+	{ 0x600060A0, "CLK_RST_CONTROLLER_PLLP_BASE_0" },
+	{ 0x600060A4, "CLK_RST_CONTROLLER_PLLP_OUTA_0" },
+	{ 0x600060A8, "CLK_RST_CONTROLLER_PLLP_OUTB_0" },
+	{ 0x600060AC, "CLK_RST_CONTROLLER_PLLP_MISC_0" },
+	{ 0x600060B0, "CLK_RST_CONTROLLER_PLLA_BASE_0" },
+	{ 0x600060B4, "CLK_RST_CONTROLLER_PLLA_OUT_0" },
+	{ 0x600060BC, "CLK_RST_CONTROLLER_PLLA_MISC_0" },
+	{ 0x600060C0, "CLK_RST_CONTROLLER_PLLU_BASE_0" },
+	{ 0x600060CC, "CLK_RST_CONTROLLER_PLLU_MISC_0" },
+	{ 0x600060D0, "CLK_RST_CONTROLLER_PLLD_BASE_0" },
+	{ 0x600060DC, "CLK_RST_CONTROLLER_PLLD_MISC_0" },
+	{ 0x600060E0, "CLK_RST_CONTROLLER_PLLX_BASE_0" },
+	{ 0x600060E4, "CLK_RST_CONTROLLER_PLLX_MISC_0" },
+	{ 0x600060E8, "CLK_RST_CONTROLLER_PLLE_BASE_0" },
+	{ 0x600060EC, "CLK_RST_CONTROLLER_PLLE_MISC_0" },
+	{ 0x60006100, "CLK_RST_CONTROLLER_CLK_SOURCE_I2S1_0" },
+	{ 0x60006104, "CLK_RST_CONTROLLER_CLK_SOURCE_I2S2_0" },
+	{ 0x60006108, "CLK_RST_CONTROLLER_CLK_SOURCE_SPDIF_OUT_0" },
+	{ 0x6000610C, "CLK_RST_CONTROLLER_CLK_SOURCE_SPDIF_IN_0" },
+	{ 0x60006110, "CLK_RST_CONTROLLER_CLK_SOURCE_PWM_0" },
+	{ 0x60006114, "CLK_RST_CONTROLLER_CLK_SOURCE_SPI1_0" },
+	{ 0x60006118, "CLK_RST_CONTROLLER_CLK_SOURCE_SPI22_0" },
+	{ 0x6000611C, "CLK_RST_CONTROLLER_CLK_SOURCE_SPI3_0" },
+	{ 0x60006120, "CLK_RST_CONTROLLER_CLK_SOURCE_XIO_0" },
+	{ 0x60006124, "CLK_RST_CONTROLLER_CLK_SOURCE_I2C1_0" },
+	{ 0x60006128, "CLK_RST_CONTROLLER_CLK_SOURCE_DVC_I2C_0" },
+	{ 0x6000612C, "CLK_RST_CONTROLLER_CLK_SOURCE_TWC_0" },
+	{ 0x60006134, "CLK_RST_CONTROLLER_CLK_SOURCE_SPI1_0" },
+	{ 0x60006138, "CLK_RST_CONTROLLER_CLK_SOURCE_DISP1_0" },
+	{ 0x6000613C, "CLK_RST_CONTROLLER_CLK_SOURCE_DISP2_0" },
+	{ 0x60006140, "CLK_RST_CONTROLLER_CLK_SOURCE_CVE_0" },
+	{ 0x60006144, "CLK_RST_CONTROLLER_CLK_SOURCE_IDE_0" },
+	{ 0x60006148, "CLK_RST_CONTROLLER_CLK_SOURCE_VI_0" },
+	{ 0x60006150, "CLK_RST_CONTROLLER_CLK_SOURCE_SDMMC1_0" },
+	{ 0x60006154, "CLK_RST_CONTROLLER_CLK_SOURCE_SDMMC2_0" },
+	{ 0x60006158, "CLK_RST_CONTROLLER_CLK_SOURCE_G3D_0" },
+	{ 0x6000615C, "CLK_RST_CONTROLLER_CLK_SOURCE_G2D_0" },
+	{ 0x60006160, "CLK_RST_CONTROLLER_CLK_SOURCE_NDFLASH_0" },
+	{ 0x60006164, "CLK_RST_CONTROLLER_CLK_SOURCE_SDMMC4_0" },
+	{ 0x60006168, "CLK_RST_CONTROLLER_CLK_SOURCE_VFIR_0" },
+	{ 0x6000616C, "CLK_RST_CONTROLLER_CLK_SOURCE_EPP_0" },
+	{ 0x60006170, "CLK_RST_CONTROLLER_CLK_SOURCE_MPE_0" },
+	{ 0x60006174, "CLK_RST_CONTROLLER_CLK_SOURCE_MIPI_0" },
+	{ 0x60006178, "CLK_RST_CONTROLLER_CLK_SOURCE_UART1_0" },
+	{ 0x6000617C, "CLK_RST_CONTROLLER_CLK_SOURCE_UART2_0" },
+	{ 0x60006180, "CLK_RST_CONTROLLER_CLK_SOURCE_HOST1X_0" },
+	{ 0x60006188, "CLK_RST_CONTROLLER_CLK_SOURCE_TVO_0" },
+	{ 0x6000618C, "CLK_RST_CONTROLLER_CLK_SOURCE_HDMI_0" },
+	{ 0x60006194, "CLK_RST_CONTROLLER_CLK_SOURCE_TVDAC_0" },
+	{ 0x60006198, "CLK_RST_CONTROLLER_CLK_SOURCE_I2C2_0" },
+	{ 0x6000619C, "CLK_RST_CONTROLLER_CLK_SOURCE_EMC_0" },
+	{ 0x600061A0, "CLK_RST_CONTROLLER_CLK_SOURCE_UART3_0" },
+	{ 0x600061A8, "CLK_RST_CONTROLLER_CLK_SOURCE_VI_SENSOR_0" },
+	{ 0x600061B4, "CLK_RST_CONTROLLER_CLK_SOURCE_SPI4_0" },
+	{ 0x600061B8, "CLK_RST_CONTROLLER_CLK_SOURCE_I2C3_0" },
+	{ 0x600061BC, "CLK_RST_CONTROLLER_CLK_SOURCE_SDMMC3_0" },
+	{ 0x600061C0, "CLK_RST_CONTROLLER_CLK_SOURCE_UART4_0" },
+	{ 0x600061C4, "CLK_RST_CONTROLLER_CLK_SOURCE_UART5_0" },
+	{ 0x600061C8, "CLK_RST_CONTROLLER_CLK_SOURCE_VDE_0" },
+	{ 0x600061CC, "CLK_RST_CONTROLLER_CLK_SOURCE_OWR_0" },
+	{ 0x600061D0, "CLK_RST_CONTROLLER_CLK_SOURCE_NOR_0" },
+	{ 0x600061D4, "CLK_RST_CONTROLLER_CLK_SOURCE_CSITE_0" },
+	{ 0x600061F8, "CLK_RST_CONTROLLER_CLK_SOURCE_LA_0" },
+	{ 0x600061FC, "CLK_RST_CONTROLLER_CLK_SOURCE_OSC_0" },
+	{ 0x60006300, "CLK_RST_CONTROLLER_RST_DEV_L_SET_0" },
+	{ 0x60006304, "CLK_RST_CONTROLLER_RST_DEV_L_CLR_0" },
+	{ 0x60006308, "CLK_RST_CONTROLLER_RST_DEV_H_SET_0" },
+	{ 0x6000630C, "CLK_RST_CONTROLLER_RST_DEV_H_CLR_0" },
+	{ 0x60006310, "CLK_RST_CONTROLLER_RST_DEV_U_SET_0" },
+	{ 0x60006314, "CLK_RST_CONTROLLER_RST_DEV_U_CLR_0" },
+	{ 0x60006320, "CLK_RST_CONTROLLER_CLK_ENB_L_SET_0" },
+	{ 0x60006324, "CLK_RST_CONTROLLER_CLK_ENB_L_CLR_0" },
+	{ 0x60006328, "CLK_RST_CONTROLLER_CLK_ENB_H_SET_0" },
+	{ 0x6000632C, "CLK_RST_CONTROLLER_CLK_ENB_H_CLR_0" },
+	{ 0x60006330, "CLK_RST_CONTROLLER_CLK_ENB_U_SET_0" },
+	{ 0x60006334, "CLK_RST_CONTROLLER_CLK_ENB_U_CLR_0" },
+	{ 0x60006340, "CLK_RST_CONTROLLER_RST_CPU_CMPLX_SET_0" },
+	{ 0x60006344, "CLK_RST_CONTROLLER_RST_CPU_CMPLX_CLR_0" },
+	{ 0x6001B000, "ARVDE_BSEV_ICMDQUE_WR_0" },
+	{ 0x6001B008, "ARVDE_BSEV_CMDQUE_CONTROL_0" },
+	{ 0x6001B018, "ARVDE_BSEV_INTR_STATUS_0" },
+	{ 0x6001B044, "ARVDE_BSEV_BSE_CONFIG_0" },
+	{ 0x6001B100, "ARVDE_BSEV_SECURE_DEST_ADDR_0" },
+	{ 0x6001B104, "ARVDE_BSEV_SECURE_INPUT_SELECT_0" },
+	{ 0x6001B108, "ARVDE_BSEV_SECURE_CONFIG_0" },
+	{ 0x6001B10C, "ARVDE_BSEV_SECURE_CONFIG_EXT_0" },
+	{ 0x6001B110, "ARVDE_BSEV_SECURE_SECURITY_0" },
+	{ 0x6001B120, "ARVDE_BSEV_SECURE_HASH_RESULT0_0" },
+	{ 0x6001B124, "ARVDE_BSEV_SECURE_HASH_RESULT1_0" },
+	{ 0x6001B128, "ARVDE_BSEV_SECURE_HASH_RESULT2_0" },
+	{ 0x6001B12C, "ARVDE_BSEV_SECURE_HASH_RESULT3_0" },
+	{ 0x6001B140, "ARVDE_BSEV_SECURE_SEC_SEL0_0" },
+	{ 0x6001B144, "ARVDE_BSEV_SECURE_SEC_SEL1_0" },
+	{ 0x6001B148, "ARVDE_BSEV_SECURE_SEC_SEL2_0" },
+	{ 0x6001B14C, "ARVDE_BSEV_SECURE_SEC_SEL3_0" },
+	{ 0x6001B150, "ARVDE_BSEV_SECURE_SEC_SEL4_0" },
+	{ 0x6001B154, "ARVDE_BSEV_SECURE_SEC_SEL5_0" },
+	{ 0x6001B158, "ARVDE_BSEV_SECURE_SEC_SEL6_0" },
+	{ 0x6001B15C, "ARVDE_BSEV_SECURE_SEC_SEL7_0" },
+};
+
+static const struct block_range block_ranges[] = {
+	{ 0x00000000, 0x3FFFFFFF, TRACE_BLOCK_DRAM,	"DRAM" },
+	{ 0x40000000, 0x4003FFFF, TRACE_BLOCK_IRAM,	"IRAM" },
+	{ 0x60006000, 0x60006FFF, TRACE_BLOCK_CAR,	NULL },
+	{ 0x60010000, 0x600100FF, TRACE_BLOCK_UCQ,	"UCQ" },
+	{ 0x60011000, 0x60011FFF, TRACE_BLOCK_BSEA,	"BSEA Unknown" },
+	{ 0x6001A000, 0x6001AFFF, TRACE_BLOCK_SXE,	"SXE" },
+	{ 0x6001B000, 0x6001BFFF, TRACE_BLOCK_BSEV,	"BSEV Unknown" },
+	{ 0x6001C000, 0x6001C0FF, TRACE_BLOCK_MBE,	"MBE" },
+	{ 0x6001C200, 0x6001C2FF, TRACE_BLOCK_PPE,	"PPE" },
+	{ 0x6001C400, 0x6001C4FF, TRACE_BLOCK_MCE,	"MCE" },
+	{ 0x6001C600, 0x6001C6FF, TRACE_BLOCK_TFE,	"TFE" },
+	{ 0x6001C800, 0x6001C8FF, TRACE_BLOCK_PPB,	"PPB" },
+	{ 0x6001CA00, 0x6001CAFF, TRACE_BLOCK_VDMA,	"VDMA" },
+	{ 0x6001CC00, 0x6001CCFF, TRACE_BLOCK_UCQ2,	"UCQ2" },
+	{ 0x6001D000, 0x6001D7FF, TRACE_BLOCK_BSEA2,	"BSEA2" },
+	{ 0x6001D800, 0x6001DAFF, TRACE_BLOCK_FRAMEID,	"FRAMEID" },
+};
+
+static const char * const irq_names[] = {
+	"INT_TMR1",
+	"INT_TMR2",
+	"INT_RTC",
+	"INT_I2S2",
+	"INT_SHR_SEM_INBOX_IBF",
+	"INT_SHR_SEM_INBOX_IBE",
+	"INT_SHR_SEM_OUTBOX_IBF",
+	"INT_SHR_SEM_OUTBOX_IBE",
+	"INT_VDE_UCQ_ERROR",
+	"INT_VDE_SYNC_TOKEN",
+	"INT_VDE_BSE_V",
+	"INT_VDE_BSE_A",
+	"INT_VDE_SXE",
+	"INT_I2S1",
+	"INT_SDMMC1",
+	"INT_SDMMC2",
+	"INT_XIO",
+	"INT_VDE",
+	"INT_AVP_UCQ",
+	"INT_SDMMC3",
+	"INT_USB",
+	"INT_USB2",
+	"INT_PRI_RES_22",
+	"INT_EIDE",
+	"INT_NANDFLASH",
+	"INT_VCP",
+	"INT_APB_DMA",
+	"INT_AHB_DMA",
+	"INT_GNT_0",
+	"INT_GNT_1",
+	"INT_OWR",
+	"INT_SDMMC4",
+	"INT_GPIO1",
+	"INT_GPIO2",
+	"INT_GPIO3",
+	"INT_GPIO4",
+	"INT_UARTA",
+	"INT_UARTB",
+	"INT_I2C",
+	"INT_SPI",
+	"INT_TWC",
+	"INT_TMR3",
+	"INT_TMR4",
+	"INT_FLOW_RSM0",
+	"INT_FLOW_RSM1",
+	"INT_SPDIF",
+	"INT_UARTC",
+	"INT_MIPI",
+	"INT_EVENTA",
+	"INT_EVENTB",
+	"INT_EVENTC",
+	"INT_EVENTD",
+	"INT_VFIR",
+	"INT_DVC",
+	"INT_SYS_STATS_MON",
+	"INT_GPIO5",
+	"INT_CPU0_PMU_INTR",
+	"INT_CPU1_PMU_INTR",
+	"INT_SEC_RES_26",
+	"INT_SPI_1",
+	"INT_APB_DMA_COP",
+	"INT_AHB_DMA_COP",
+	"INT_DMA_TX",
+	"INT_DMA_RX",
+	"INT_HOST1X_COP_SYNCPT",
+	"INT_HOST1X_MPCORE_SYNCPT",
+	"INT_HOST1X_COP_GENERAL",
+	"INT_HOST1X_MPCORE_GENERAL",
+	"INT_MPE_GENERAL",
+	"INT_VI_GENERAL",
+	"INT_EPP_GENERAL",
+	"INT_ISP_GENERAL",
+	"INT_2D_GENERAL",
+	"INT_DISPLAY_GENERAL",
+	"INT_DISPLAY_B_GENERAL",
+	"INT_HDMI",
+	"INT_TVO_GENERAL",
+	"INT_MC_GENERAL",
+	"INT_EMC_GENERAL",
+	"INT_TRI_RES_15",
+	"INT_TRI_RES_16",
+	"INT_AC97",
+	"INT_SPI_2",
+	"INT_SPI_3",
+	"INT_I2C2",
+	"INT_KBC",
+	"INT_EXTERNAL_PMU",
+	"INT_GPIO6",
+	"INT_TVDAC",
+	"INT_GPIO7",
+	"INT_UARTD",
+	"INT_UARTE",
+	"INT_I2C3",
+	"INT_SPI_4",
+	"INT_TRI_RES_30",
+	"INT_SW_RESERVED",
+	"INT_SNOR",
+	"INT_USB3",
+	"INT_PCIE_INTR",
+	"INT_PCIE_MSI",
+	"INT_QUAD_RES_4",
+	"INT_QUAD_RES_5",
+	"INT_QUAD_RES_6",
+	"INT_QUAD_RES_7",
+	"INT_APB_DMA_CH0",
+	"INT_APB_DMA_CH1",
+	"INT_APB_DMA_CH2",
+	"INT_APB_DMA_CH3",
+	"INT_APB_DMA_CH4",
+	"INT_APB_DMA_CH5",
+	"INT_APB_DMA_CH6",
+	"INT_APB_DMA_CH7",
+	"INT_APB_DMA_CH8",
+	"INT_APB_DMA_CH9",
+	"INT_APB_DMA_CH10",
+	"INT_APB_DMA_CH11",
+	"INT_APB_DMA_CH12",
+	"INT_APB_DMA_CH13",
+	"INT_APB_DMA_CH14",
+	"INT_APB_DMA_CH15",
+	"INT_QUAD_RES_24",
+	"INT_QUAD_RES_25",
+	"INT_QUAD_RES_26",
+	"INT_QUAD_RES_27",
+	"INT_QUAD_RES_28",
+	"INT_QUAD_RES_29",
+	"INT_QUAD_RES_30",
+	"INT_QUAD_RES_31",
+};
+
+static const char * const block_names[TRACE_BLOCKS_NB] = {
+	[TRACE_BLOCK_DRAM]	= "DRAM",
+	[TRACE_BLOCK_IRAM]	= "IRAM",
+	[TRACE_BLOCK_CAR]	= "CAR",
+	[TRACE_BLOCK_UCQ]	= "UCQ",
+	[TRACE_BLOCK_BSEA]	= "BSEA",
+	[TRACE_BLOCK_SXE]	= "SXE",
+	[TRACE_BLOCK_BSEV]	= "BSEV",
+	[TRACE_BLOCK_MBE]	= "MBE",
+	[TRACE_BLOCK_PPE]	= "PPE",
+	[TRACE_BLOCK_MCE]	= "MCE",
+	[TRACE_BLOCK_TFE]	= "TFE",
+	[TRACE_BLOCK_PPB]	= "PPB",
+	[TRACE_BLOCK_VDMA]	= "VDMA",
+	[TRACE_BLOCK_UCQ2]	= "UCQ2",
+	[TRACE_BLOCK_BSEA2]	= "BSEA2",
+	[TRACE_BLOCK_FRAMEID]	= "FRAMEID",
+	[TRACE_BLOCK_UNKNOWN]	= "UNKNOWN",
+	[TRACE_BLOCK_IRQ]	= "IRQ",
+};
+
+static const char * const type_names[TRACE_TYPES_NB] = {
+	[TRACE_IRQ]		= "IRQ",
+	[TRACE_READ32]		= "READ32",
+	[TRACE_WRITE32]		= "WRITE32",
+	[TRACE_READ32_ALT]	= "READ32_ALT",
+	[TRACE_READ8]		= "READ8",
+	[TRACE_WRITE8]		= "WRITE8",
+	[TRACE_READ16]		= "READ16",
+	[TRACE_WRITE16]		= "WRITE16",
+	[TRACE_MEMSET32]	= "MEMSET32",
+};
+
+/* Record tags as printed by bin_to_txt.pl */
+static const char * const type_tags[TRACE_TYPES_NB] = {
+	[TRACE_IRQ]		= "IRQ:     ",
+	[TRACE_READ32]		= "READ32:  ",
+	[TRACE_WRITE32]		= "WRITE32: ",
+	[TRACE_READ32_ALT]	= "READ32\"  ",
+	[TRACE_READ8]		= "READ8:   ",
+	[TRACE_WRITE8]		= "WRITE8:  ",
+	[TRACE_READ16]		= "READ16:  ",
+	[TRACE_WRITE16]		= "WRITE16: ",
+	[TRACE_MEMSET32]	= "MEMSET32:",
+};
+
+int trace_version_valid(uint32_t version)
+{
+	switch (version) {
+	case 06122015:
+	case 16122015:
+	case 20151226:
+		return 1;
+	}
+
+	return 0;
+}
+
+int trace_open(struct trace_file *trace, const char *path)
+{
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	if (fstat(fd, &st) != 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size < TRACE_HEADER_SIZE) {
+		fprintf(stderr, "%s: Trace is too short\n", path);
+		close(fd);
+		return -1;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	trace->data = data;
+	trace->size = st.st_size;
+	trace->mtime_ns = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+	trace->version = trace_be32(data);
+	trace->records_nb = (st.st_size - TRACE_HEADER_SIZE) / TRACE_RECORD_SIZE;
+
+	if (!trace_version_valid(trace->version)) {
+		fprintf(stderr, "%s: Record version mismatch %u\n",
+			path, trace->version);
+		trace_close(trace);
+		return -1;
+	}
+
+	return 0;
+}
+
+void trace_close(struct trace_file *trace)
+{
+	munmap((void *)trace->data, trace->size);
+	trace->data = NULL;
+}
+
+/* Whether the trace can't be mapped and has to be read as a stream */
+int trace_is_stream(const char *path)
+{
+	struct stat st;
+
+	if (strcmp(path, "-") == 0 || strncmp(path, "unix:", 5) == 0) {
+		return 1;
+	}
+
+	return stat(path, &st) == 0 && !S_ISREG(st.st_mode);
+}
+
+/*
+ * Opens a FIFO, connects to the "unix:PATH" stream socket or takes stdin
+ * for "-". The socket producer may be started after us, the connection
+ * is retried for a few seconds.
+ */
+int trace_stream_connect(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct timespec ts = { 0, 100000000 };
+	int retries = CONNECT_RETRIES;
+	int fd;
+
+	if (strcmp(path, "-") == 0) {
+		return STDIN_FILENO;
+	}
+
+	if (strncmp(path, "unix:", 5) != 0) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			perror(path);
+		}
+		return fd;
+	}
+
+	if (strlen(path + 5) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: Socket path is too long\n", path);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path + 5);
+
+	for (;;) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) {
+			perror("socket");
+			return -1;
+		}
+
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+			return fd;
+		}
+
+		close(fd);
+
+		if ((errno != ENOENT && errno != ECONNREFUSED) ||
+		    --retries == 0) {
+			perror(path);
+			return -1;
+		}
+
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* Reads more data, returns the number of bytes read, 0 at the end */
+static ssize_t stream_fill(struct trace_stream *stream)
+{
+	ssize_t ret;
+
+	memmove(stream->buf, stream->buf + stream->pos,
+		stream->len - stream->pos);
+	stream->len -= stream->pos;
+	stream->pos = 0;
+
+	do {
+		ret = read(stream->fd, stream->buf + stream->len,
+			   sizeof(stream->buf) - stream->len);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		perror(stream->path);
+		return -1;
+	}
+
+	stream->len += ret;
+
+	return ret;
+}
+
+int trace_stream_open(struct trace_stream *stream, const char *path)
+{
+	ssize_t ret = 1;
+
+	stream->path = path;
+	stream->records_nb = 0;
+	stream->len = 0;
+	stream->pos = 0;
+
+	stream->fd = trace_stream_connect(path);
+	if (stream->fd < 0) {
+		return -1;
+	}
+
+	while (stream->len < TRACE_HEADER_SIZE && ret > 0) {
+		ret = stream_fill(stream);
+	}
+
+	if (stream->len < TRACE_HEADER_SIZE) {
+		if (ret == 0) {
+			fprintf(stderr, "%s: Trace is too short\n", path);
+		}
+		trace_stream_close(stream);
+		return -1;
+	}
+
+	stream->version = trace_be32(stream->buf);
+	stream->pos = TRACE_HEADER_SIZE;
+
+	if (!trace_version_valid(stream->version)) {
+		fprintf(stderr, "%s: Record version mismatch %u\n",
+			path, stream->version);
+		trace_stream_close(stream);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns 1 with the next record, 0 at the end of the stream and -1 on
+ * a read error. Blocks until the producer writes the record.
+ */
+int trace_stream_next(struct trace_stream *stream, struct trace_record *rec)
+{
+	ssize_t ret;
+
+	while (stream->len - stream->pos < TRACE_RECORD_SIZE) {
+		ret = stream_fill(stream);
+		if (ret < 0) {
+			return -1;
+		}
+
+		if (ret == 0) {
+			if (stream->len != stream->pos) {
+				fprintf(stderr, "%s: Trailing partial record "
+					"dropped\n", stream->path);
+			}
+			return 0;
+		}
+	}
+
+	trace_decode(stream->buf + stream->pos, rec);
+	stream->pos += TRACE_RECORD_SIZE;
+	stream->records_nb++;
+
+	return 1;
+}
+
+void trace_stream_close(struct trace_stream *stream)
+{
+	if (stream->fd != STDIN_FILENO) {
+		close(stream->fd);
+	}
+
+	stream->fd = -1;
+}
+
+const char * trace_src_name(int src)
+{
+	return (src == TRACE_ON_AVP) ? "ON_AVP" : "ON_CPU";
+}
+
+const char * trace_type_name(uint32_t type)
+{
+	if (type >= TRACE_TYPES_NB) {
+		return "UNKNOWN";
+	}
+
+	return type_names[type];
+}
+
+static int reg_name_cmp(const void *key, const void *elt)
+{
+	uint32_t addr = *(const uint32_t *)key;
+	const struct reg_name *reg = elt;
+
+	if (addr < reg->addr) {
+		return -1;
+	}
+
+	return addr > reg->addr;
+}
+
+static const struct block_range * addr_to_range(uint32_t addr)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(block_ranges); i++) {
+		if (addr >= block_ranges[i].start &&
+		    addr <= block_ranges[i].end) {
+			return &block_ranges[i];
+		}
+	}
+
+	return NULL;
+}
+
+const char * trace_reg_name(uint32_t addr)
+{
+	const struct block_range *range;
+	const struct reg_name *reg;
+
+	reg = bsearch(&addr, reg_names, ARRAY_SIZE(reg_names),
+		      sizeof(reg_names[0]), reg_name_cmp);
+	if (reg != NULL) {
+		return reg->name;
+	}
+
+	range = addr_to_range(addr);
+	if (range != NULL && range->name != NULL) {
+		return range->name;
+	}
+
+	return "Unknown register";
+}
+
+const char * trace_irq_name(uint32_t irq)
+{
+	if (irq >= ARRAY_SIZE(irq_names)) {
+		return NULL;
+	}
+
+	return irq_names[irq];
+}
+
+const char * trace_block_name(int block)
+{
+	assert(block >= 0 && block < TRACE_BLOCKS_NB);
+
+	return block_names[block];
+}
+
+int trace_block_by_name(const char *name)
+{
+	int i;
+
+	for (i = 0; i < TRACE_BLOCKS_NB; i++) {
+		if (strcasecmp(name, block_names[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+int trace_addr_to_block(uint32_t addr)
+{
+	const struct block_range *range = addr_to_range(addr);
+
+	if (range == NULL) {
+		return TRACE_BLOCK_UNKNOWN;
+	}
+
+	return range->block;
+}
+
+int trace_record_block(const struct trace_record *rec)
+{
+	if (rec->type == TRACE_IRQ) {
+		return TRACE_BLOCK_IRQ;
+	}
+
+	return trace_addr_to_block(rec->addr);
+}
+
+static char * put_str(char *p, const char *str)
+{
+	size_t len = strlen(str);
+
+	memcpy(p, str, len);
+
+	return p + len;
+}
+
+static char * put_hex32(char *p, uint32_t val)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	int i;
+
+	*p++ = '0';
+	*p++ = 'x';
+
+	for (i = 7; i >= 0; i--, val >>= 4) {
+		p[i] = hex[val & 0xF];
+	}
+
+	return p + 8;
+}
+
+/*
+ * Formats record the way bin_to_txt.pl does, count is printed only for
+ * MEMSET32. Returns line length or -1 if record can't be described.
+ */
+int trace_format_record(char *buf, const struct trace_record *rec,
+			uint32_t count)
+{
+	const char *dsc;
+	char *p = buf;
+
+	if (rec->type >= TRACE_TYPES_NB) {
+		return -1;
+	}
+
+	if (rec->type == TRACE_IRQ) {
+		dsc = trace_irq_name(rec->addr);
+	} else {
+		dsc = trace_reg_name(rec->addr);
+	}
+
+	if (dsc == NULL) {
+		return -1;
+	}
+
+	p = put_str(p, trace_src_name(rec->src));
+	p = put_str(p, ": ");
+	p = put_str(p, type_tags[rec->type]);
+	*p++ = ' ';
+	p = put_hex32(p, rec->addr);
+	*p++ = ' ';
+	p = put_hex32(p, rec->value);
+	*p++ = '\t';
+	*p++ = '"';
+	p = put_str(p, dsc);
+	*p++ = '"';
+
+	if (rec->type == TRACE_MEMSET32) {
+		p += sprintf(p, " %u", count);
+	}
+
+	*p++ = '\n';
+
+	return p - buf;
+}
+
+/* Single write isn't a sequence and is printed as is */
+int trace_format_seq(char *buf, const struct trace_seq *seq)
+{
+	struct trace_record rec = {
+		.type	= seq->count > 1 ? TRACE_MEMSET32 : TRACE_WRITE32,
+		.addr	= seq->addr,
+		.value	= seq->value,
+		.src	= seq->src,
+	};
+
+	return trace_format_record(buf, &rec, seq->count);
+}
+
+void trace_frame_init(struct trace_frame_tracker *ft)
+{
+	ft->state = TRACE_FRAME_IDLE;
+	ft->frames_nb = 0;
+	ft->started = 0;
+	ft->ended = 0;
+}
+
+/*
+ * Mirrors the frame split done by split.pl: the frame starts after the
+ * last VDE reset preceding the SXE interrupt and everything past the BSEV
+ * trailer write is cut off. Returns 1 if the record belongs to the frame.
+ */
+int trace_frame_update(struct trace_frame_tracker *ft,
+		       const struct trace_record *rec)
+{
+	ft->started = 0;
+	ft->ended = 0;
+
+	if (rec->type == TRACE_IRQ) {
+		if (rec->addr != TRACE_FRAME_IRQ || rec->value != 1 ||
+		    ft->state == TRACE_FRAME_IDLE) {
+			return ft->state == TRACE_FRAME_ACTIVE;
+		}
+
+		ft->ended = 1;
+		ft->frames_nb++;
+
+		if (ft->state == TRACE_FRAME_TRIMMED) {
+			ft->state = TRACE_FRAME_IDLE;
+			return 0;
+		}
+
+		ft->state = TRACE_FRAME_IDLE;
+		return 1;
+	}
+
+	if (rec->addr == TRACE_FRAME_RESET_ADDR) {
+		ft->state = TRACE_FRAME_ACTIVE;
+		ft->started = 1;
+		return 0;
+	}
+
+	if (ft->state == TRACE_FRAME_ACTIVE && rec->src == TRACE_ON_AVP &&
+	    rec->type == TRACE_WRITE32 && rec->addr == TRACE_FRAME_TRIM_ADDR &&
+	    rec->value == 1) {
+		ft->state = TRACE_FRAME_TRIMMED;
+	}
+
+	return ft->state == TRACE_FRAME_ACTIVE;
+}
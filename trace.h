@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary IO trace recorded by the trace viewer: 4 bytes big-endian version
+ * followed by packed 13 bytes records, see bin_to_txt.pl.
+ */
+#define TRACE_HEADER_SIZE	4
+#define TRACE_RECORD_SIZE	13
+
+/* Frame is everything between the VDE reset and the SXE interrupt */
+#define TRACE_FRAME_RESET_ADDR	0x60006308	/* CLK_RST_CONTROLLER_RST_DEV_H_SET_0 */
+#define TRACE_FRAME_TRIM_ADDR	0x6001B08C
+#define TRACE_FRAME_IRQ		12		/* INT_VDE_SXE */
+
+/* Sequential 32bit writes below that address are merged into MEMSET32 */
+#define TRACE_MEMSET_ADDR_END	0x40040000
+
+enum {
+	TRACE_ON_CPU,
+	TRACE_ON_AVP,
+	TRACE_SRC_NB,
+};
+
+enum {
+	TRACE_IRQ,
+	TRACE_READ32,
+	TRACE_WRITE32,
+	TRACE_READ32_ALT,
+	TRACE_READ8,
+	TRACE_WRITE8,
+	TRACE_READ16,
+	TRACE_WRITE16,
+	TRACE_MEMSET32,
+	TRACE_TYPES_NB,
+};
+
+enum {
+	TRACE_BLOCK_DRAM,
+	TRACE_BLOCK_IRAM,
+	TRACE_BLOCK_CAR,
+	TRACE_BLOCK_UCQ,
+	TRACE_BLOCK_BSEA,
+	TRACE_BLOCK_SXE,
+	TRACE_BLOCK_BSEV,
+	TRACE_BLOCK_MBE,
+	TRACE_BLOCK_PPE,
+	TRACE_BLOCK_MCE,
+	TRACE_BLOCK_TFE,
+	TRACE_BLOCK_PPB,
+	TRACE_BLOCK_VDMA,
+	TRACE_BLOCK_UCQ2,
+	TRACE_BLOCK_BSEA2,
+	TRACE_BLOCK_FRAMEID,
+	TRACE_BLOCK_UNKNOWN,
+	TRACE_BLOCK_IRQ,
+	TRACE_BLOCKS_NB,
+};
+
+struct trace_record {
+	uint32_t type;
+	uint32_t addr;		/* register address or IRQ number */
+	uint32_t value;
+	uint8_t src;
+};
+
+/* Run of sequential and identical 32bit memory writes */
+struct trace_seq {
+	uint32_t addr;
+	uint32_t value;
+	uint32_t count;
+	uint8_t src;
+};
+
+struct trace_file {
+	const uint8_t *data;
+	size_t size;
+	int64_t mtime_ns;	/* file modification time */
+	uint32_t version;
+	uint64_t records_nb;
+};
+
+/*
+ * Trace read sequentially from a FIFO, a Unix socket or stdin while it is
+ * being recorded, see trace_stream_connect().
+ */
+struct trace_stream {
+	const char *path;
+	int fd;
+	uint32_t version;
+	uint64_t records_nb;	/* number of records read so far */
+	size_t len;
+	size_t pos;
+	uint8_t buf[TRACE_RECORD_SIZE * 4096];
+};
+
+/* Longest line produced by trace_format_record() */
+#define TRACE_LINE_MAX		128
+
+enum {
+	TRACE_FRAME_IDLE,
+	TRACE_FRAME_ACTIVE,
+	TRACE_FRAME_TRIMMED,
+};
+
+struct trace_frame_tracker {
+	int state;
+	uint32_t frames_nb;	/* number of completed frames */
+	int started;		/* last record (re)started a frame */
+	int ended;		/* last record completed a frame */
+};
+
+static inline uint32_t trace_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline uint8_t trace_decode_src(uint8_t byte)
+{
+	return ((int8_t)byte == 1) ? TRACE_ON_AVP : TRACE_ON_CPU;
+}
+
+static inline void trace_decode(const uint8_t *p, struct trace_record *rec)
+{
+	rec->src   = trace_decode_src(p[0]);
+	rec->type  = trace_be32(p + 1);
+	rec->addr  = trace_be32(p + 5);
+	rec->value = trace_be32(p + 9);
+}
+
+static inline void trace_get_record(const struct trace_file *trace,
+				    uint64_t idx, struct trace_record *rec)
+{
+	trace_decode(trace->data + TRACE_HEADER_SIZE + idx * TRACE_RECORD_SIZE,
+		     rec);
+}
+
+static inline int trace_seq_mergeable(const struct trace_record *rec)
+{
+	return rec->type == TRACE_WRITE32 && rec->addr < TRACE_MEMSET_ADDR_END;
+}
+
+static inline void trace_seq_start(struct trace_seq *seq,
+				   const struct trace_record *rec)
+{
+	seq->addr  = rec->addr;
+	seq->value = rec->value;
+	seq->src   = rec->src;
+	seq->count = 1;
+}
+
+static inline int trace_seq_continues(const struct trace_seq *seq,
+				      const struct trace_record *rec)
+{
+	return seq->count != 0 && trace_seq_mergeable(rec) &&
+	       (uint64_t)seq->addr + seq->count * 4ull == rec->addr &&
+	       seq->value == rec->value && seq->src == rec->src;
+}
+
+int trace_version_valid(uint32_t version);
+int trace_open(struct trace_file *trace, const char *path);
+void trace_close(struct trace_file *trace);
+
+int trace_is_stream(const char *path);
+int trace_stream_connect(const char *path);
+int trace_stream_open(struct trace_stream *stream, const char *path);
+int trace_stream_next(struct trace_stream *stream, struct trace_record *rec);
+void trace_stream_close(struct trace_stream *stream);
+
+const char * trace_src_name(int src);
+const char * trace_type_name(uint32_t type);
+const char * trace_reg_name(uint32_t addr);
+const char * trace_irq_name(uint32_t irq);
+const char * trace_block_name(int block);
+int trace_block_by_name(const char *name);
+int trace_addr_to_block(uint32_t addr);
+int trace_record_block(const struct trace_record *rec);
+
+int trace_format_record(char *buf, const struct trace_record *rec,
+			uint32_t count);
+int trace_format_seq(char *buf, const struct trace_seq *seq);
+
+void trace_frame_init(struct trace_frame_tracker *ft);
+int trace_frame_update(struct trace_frame_tracker *ft,
+		       const struct trace_record *rec);
+
+#endif // TRACE_H
@@ -0,0 +1,534 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "trace_arc.h"
+
+#define HEADER_SIZE		48
+#define TAIL_MAX		(TRACE_RECORD_SIZE - 1)
+#define BLOCK_HEADER_SIZE	20
+#define DIR_BLOCK_SIZE		24
+#define DIR_FRAME_SIZE		16
+
+/* Worst case column sizes of a block */
+#define SRC_COL_MAX	(TRACE_INDEX_BLOCK_RECORDS * 6)
+#define TYPE_COL_MAX	(TRACE_INDEX_BLOCK_RECORDS * 10)
+#define ADDR_COL_MAX	(TRACE_INDEX_BLOCK_RECORDS * 5)
+#define VALUE_COL_MAX	(TRACE_INDEX_BLOCK_RECORDS * 5)
+
+struct column {
+	uint8_t *data;
+	size_t len;
+};
+
+struct reader {
+	const uint8_t *p;
+	const uint8_t *end;
+};
+
+static uint8_t * put_le32(uint8_t *p, uint32_t val)
+{
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+
+	return p + 4;
+}
+
+static uint8_t * put_le64(uint8_t *p, uint64_t val)
+{
+	p = put_le32(p, val);
+
+	return put_le32(p, val >> 32);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static void put_varint(struct column *col, uint32_t val)
+{
+	while (val >= 0x80) {
+		col->data[col->len++] = val | 0x80;
+		val >>= 7;
+	}
+
+	col->data[col->len++] = val;
+}
+
+static int get_varint(struct reader *rd, uint32_t *val)
+{
+	uint32_t res = 0;
+	int shift;
+
+	for (shift = 0; shift < 35; shift += 7) {
+		if (rd->p == rd->end) {
+			return -1;
+		}
+
+		res |= (uint32_t)(*rd->p & 0x7F) << shift;
+
+		if (!(*rd->p++ & 0x80)) {
+			*val = res;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static uint32_t zigzag(uint32_t cur, uint32_t prev)
+{
+	int32_t delta = cur - prev;
+
+	return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+}
+
+static uint32_t unzigzag(uint32_t zz, uint32_t prev)
+{
+	return prev + ((zz >> 1) ^ -(zz & 1));
+}
+
+/* Source byte as recorded, anything but 1 is decoded as the CPU */
+static uint8_t raw_src(const struct trace_file *trace, uint64_t idx)
+{
+	return trace->data[TRACE_HEADER_SIZE + idx * TRACE_RECORD_SIZE];
+}
+
+static void encode_block(const struct trace_file *trace, uint64_t first,
+			 unsigned nb, struct column cols[4])
+{
+	struct trace_record rec, prev = { 0 };
+	uint32_t src_run = 0, type_run = 0;
+	uint8_t src, prev_src = 0;
+	unsigned i;
+
+	for (i = 0; i < 4; i++) {
+		cols[i].len = 0;
+	}
+
+	for (i = 0; i < nb; i++) {
+		trace_get_record(trace, first + i, &rec);
+		src = raw_src(trace, first + i);
+
+		if (i > 0 && src != prev_src) {
+			put_varint(&cols[0], src_run);
+			cols[0].data[cols[0].len++] = prev_src;
+			src_run = 0;
+		}
+
+		if (i > 0 && rec.type != prev.type) {
+			put_varint(&cols[1], type_run);
+			put_varint(&cols[1], prev.type);
+			type_run = 0;
+		}
+
+		src_run++;
+		type_run++;
+
+		put_varint(&cols[2], zigzag(rec.addr, prev.addr));
+		put_varint(&cols[3], zigzag(rec.value, prev.value));
+
+		prev = rec;
+		prev_src = src;
+	}
+
+	if (nb) {
+		put_varint(&cols[0], src_run);
+		cols[0].data[cols[0].len++] = prev_src;
+
+		put_varint(&cols[1], type_run);
+		put_varint(&cols[1], prev.type);
+	}
+}
+
+int trace_arc_pack(const struct trace_file *trace, const char *path)
+{
+	struct trace_index idx;
+	struct trace_record rec;
+	struct column cols[4];
+	uint8_t hdr[HEADER_SIZE];
+	uint8_t buf[BLOCK_HEADER_SIZE + DIR_BLOCK_SIZE];
+	uint64_t *offsets;
+	uint64_t offset = HEADER_SIZE;
+	uint64_t blk, i;
+	uint32_t tail_len;
+	unsigned nb;
+	FILE *fp;
+	int c;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	cols[0].data = malloc(SRC_COL_MAX);
+	cols[1].data = malloc(TYPE_COL_MAX);
+	cols[2].data = malloc(ADDR_COL_MAX);
+	cols[3].data = malloc(VALUE_COL_MAX);
+
+	trace_index_init(&idx, trace);
+
+	offsets = malloc(idx.blocks_nb * sizeof(*offsets) + 1);
+	assert(offsets != NULL);
+
+	for (c = 0; c < 4; c++) {
+		assert(cols[c].data != NULL);
+	}
+
+	tail_len = trace->size - TRACE_HEADER_SIZE -
+		   trace->records_nb * TRACE_RECORD_SIZE;
+
+	/* Directory offset is filled in at the end */
+	memset(hdr, 0, HEADER_SIZE);
+	memcpy(hdr, TRACE_ARC_MAGIC, 8);
+	put_le32(hdr + 8, trace->version);
+	put_le32(hdr + 12, TRACE_INDEX_BLOCK_RECORDS);
+	put_le64(hdr + 16, trace->records_nb);
+	put_le64(hdr + 24, 0);
+	put_le32(hdr + 32, tail_len);
+	memcpy(hdr + 36, trace->data + trace->size - tail_len, tail_len);
+	fwrite(hdr, 1, HEADER_SIZE, fp);
+
+	for (blk = 0; blk < idx.blocks_nb; blk++) {
+		i = blk * TRACE_INDEX_BLOCK_RECORDS;
+		nb = TRACE_INDEX_BLOCK_RECORDS;
+
+		if (i + nb > trace->records_nb) {
+			nb = trace->records_nb - i;
+		}
+
+		for (; i < blk * TRACE_INDEX_BLOCK_RECORDS + nb; i++) {
+			trace_get_record(trace, i, &rec);
+
+			if (rec.type >= TRACE_TYPES_NB) {
+				continue;
+			}
+
+			trace_index_account(&idx, i, &rec);
+
+			if (trace_frame_marker(&rec)) {
+				trace_index_frame_update(&idx, i, &rec);
+			}
+		}
+
+		encode_block(trace, blk * TRACE_INDEX_BLOCK_RECORDS, nb, cols);
+
+		put_le32(buf, nb);
+		for (c = 0; c < 4; c++) {
+			put_le32(buf + 4 + c * 4, cols[c].len);
+		}
+		fwrite(buf, 1, BLOCK_HEADER_SIZE, fp);
+
+		offsets[blk] = offset;
+		offset += BLOCK_HEADER_SIZE;
+
+		for (c = 0; c < 4; c++) {
+			fwrite(cols[c].data, 1, cols[c].len, fp);
+			offset += cols[c].len;
+		}
+	}
+
+	put_le64(buf, idx.blocks_nb);
+	put_le64(buf + 8, idx.frames_nb);
+	fwrite(buf, 1, 16, fp);
+
+	for (blk = 0; blk < idx.blocks_nb; blk++) {
+		const struct trace_index_block *b = &idx.blocks[blk];
+		uint8_t *p = buf;
+
+		p = put_le64(p, offsets[blk]);
+		p = put_le32(p, b->blocks_mask);
+		p = put_le32(p, b->types_mask | (b->src_mask << 16));
+		p = put_le32(p, b->addr_min);
+		p = put_le32(p, b->addr_max);
+		fwrite(buf, 1, DIR_BLOCK_SIZE, fp);
+	}
+
+	for (i = 0; i < idx.frames_nb; i++) {
+		put_le64(buf, idx.frames[i].first);
+		put_le64(buf + 8, idx.frames[i].end);
+		fwrite(buf, 1, DIR_FRAME_SIZE, fp);
+	}
+
+	put_le64(hdr + 24, offset);
+	fseek(fp, 0, SEEK_SET);
+	fwrite(hdr, 1, HEADER_SIZE, fp);
+
+	for (c = 0; c < 4; c++) {
+		free(cols[c].data);
+	}
+
+	free(offsets);
+	trace_index_free(&idx);
+
+	if (ferror(fp) != 0 || fclose(fp) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int trace_arc_probe(const char *path)
+{
+	char magic[8];
+	FILE *fp;
+	int ret;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return 0;
+	}
+
+	ret = fread(magic, 1, 8, fp) == 8 &&
+	      memcmp(magic, TRACE_ARC_MAGIC, 8) == 0;
+
+	fclose(fp);
+
+	return ret;
+}
+
+static int arc_corrupted(struct trace_arc *arc, const char *path)
+{
+	fprintf(stderr, "%s: Archive is corrupted\n", path);
+	trace_arc_close(arc);
+
+	return -1;
+}
+
+int trace_arc_open(struct trace_arc *arc, const char *path)
+{
+	struct trace_index *idx = &arc->index;
+	const uint8_t *p;
+	uint64_t dir, i;
+	struct stat st;
+	void *data;
+	int fd;
+
+	memset(arc, 0, sizeof(*arc));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE + 16) {
+		fprintf(stderr, "%s: Archive is too short\n", path);
+		close(fd);
+		return -1;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+
+	arc->data = data;
+	arc->size = st.st_size;
+
+	if (memcmp(data, TRACE_ARC_MAGIC, 8) != 0 ||
+	    get_le32(arc->data + 12) != TRACE_INDEX_BLOCK_RECORDS) {
+		return arc_corrupted(arc, path);
+	}
+
+	idx->version = get_le32(arc->data + 8);
+	idx->records_nb = get_le64(arc->data + 16);
+	dir = get_le64(arc->data + 24);
+	arc->tail_len = get_le32(arc->data + 32);
+	arc->tail = arc->data + 36;
+
+	if (arc->tail_len > TAIL_MAX) {
+		return arc_corrupted(arc, path);
+	}
+
+	if (dir < HEADER_SIZE || dir + 16 > arc->size) {
+		return arc_corrupted(arc, path);
+	}
+
+	p = arc->data + dir;
+	idx->blocks_nb = get_le64(p);
+	idx->frames_nb = get_le64(p + 8);
+	p += 16;
+
+	if (idx->blocks_nb != (idx->records_nb + TRACE_INDEX_BLOCK_RECORDS - 1) /
+				TRACE_INDEX_BLOCK_RECORDS ||
+	    (arc->size - dir - 16) / DIR_BLOCK_SIZE < idx->blocks_nb ||
+	    (arc->size - dir - 16) / DIR_FRAME_SIZE < idx->frames_nb ||
+	    arc->size - dir - 16 != idx->blocks_nb * DIR_BLOCK_SIZE +
+				    idx->frames_nb * DIR_FRAME_SIZE) {
+		return arc_corrupted(arc, path);
+	}
+
+	arc->offsets = malloc(idx->blocks_nb * sizeof(*arc->offsets) + 1);
+	idx->blocks = malloc(idx->blocks_nb * sizeof(*idx->blocks) + 1);
+	idx->frames = malloc(idx->frames_nb * sizeof(*idx->frames) + 1);
+	assert(arc->offsets && idx->blocks && idx->frames);
+
+	for (i = 0; i < idx->blocks_nb; i++, p += DIR_BLOCK_SIZE) {
+		arc->offsets[i] = get_le64(p);
+		idx->blocks[i].blocks_mask = get_le32(p + 8);
+		idx->blocks[i].types_mask = get_le32(p + 12) & 0xFFFF;
+		idx->blocks[i].src_mask = get_le32(p + 12) >> 16;
+		idx->blocks[i].addr_min = get_le32(p + 16);
+		idx->blocks[i].addr_max = get_le32(p + 20);
+
+		if (arc->offsets[i] + BLOCK_HEADER_SIZE > dir) {
+			return arc_corrupted(arc, path);
+		}
+	}
+
+	for (i = 0; i < idx->frames_nb; i++, p += DIR_FRAME_SIZE) {
+		idx->frames[i].first = get_le64(p);
+		idx->frames[i].end = get_le64(p + 8);
+	}
+
+	if (!trace_index_valid(idx)) {
+		return arc_corrupted(arc, path);
+	}
+
+	return 0;
+}
+
+void trace_arc_close(struct trace_arc *arc)
+{
+	if (arc->data != NULL) {
+		munmap((void *)arc->data, arc->size);
+	}
+
+	trace_index_free(&arc->index);
+	free(arc->offsets);
+	memset(arc, 0, sizeof(*arc));
+}
+
+static int decode_rle(struct reader *rd, struct trace_record *recs,
+		      uint8_t *src_bytes, unsigned nb)
+{
+	uint32_t run, val;
+	unsigned i = 0;
+
+	while (i < nb) {
+		if (get_varint(rd, &run) != 0 || run > nb - i) {
+			return -1;
+		}
+
+		if (src_bytes != NULL) {
+			if (rd->p == rd->end) {
+				return -1;
+			}
+			val = *rd->p++;
+		} else if (get_varint(rd, &val) != 0) {
+			return -1;
+		}
+
+		while (run--) {
+			if (src_bytes != NULL) {
+				src_bytes[i] = val;
+				recs[i++].src = trace_decode_src(val);
+			} else {
+				recs[i++].type = val;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Returns number of records decoded into recs or -1 on corruption, the
+ * recorded source bytes go to src_bytes if it isn't NULL.
+ */
+int trace_arc_decode(const struct trace_arc *arc, uint64_t blk,
+		     struct trace_record *recs, uint8_t *src_bytes)
+{
+	uint8_t bytes[TRACE_INDEX_BLOCK_RECORDS];
+	const uint8_t *p = arc->data + arc->offsets[blk];
+	const uint8_t *end = arc->data + arc->size;
+	uint32_t prev_addr = 0, prev_value = 0, zz;
+	struct reader rd[4];
+	uint64_t expected;
+	unsigned nb, i;
+	int c;
+
+	/* Every block but the last one is full */
+	expected = arc->index.records_nb - blk * TRACE_INDEX_BLOCK_RECORDS;
+	if (expected > TRACE_INDEX_BLOCK_RECORDS) {
+		expected = TRACE_INDEX_BLOCK_RECORDS;
+	}
+
+	nb = get_le32(p);
+	if (nb != expected) {
+		return -1;
+	}
+
+	rd[0].p = p + BLOCK_HEADER_SIZE;
+
+	for (c = 0; c < 4; c++) {
+		uint32_t len = get_le32(p + 4 + c * 4);
+
+		if (c > 0) {
+			rd[c].p = rd[c - 1].end;
+		}
+
+		if (len > (size_t)(end - rd[c].p)) {
+			return -1;
+		}
+
+		rd[c].end = rd[c].p + len;
+	}
+
+	if (decode_rle(&rd[0], recs, src_bytes ?: bytes, nb) != 0 ||
+	    decode_rle(&rd[1], recs, NULL, nb) != 0) {
+		return -1;
+	}
+
+	for (i = 0; i < nb; i++) {
+		if (get_varint(&rd[2], &zz) != 0) {
+			return -1;
+		}
+		recs[i].addr = prev_addr = unzigzag(zz, prev_addr);
+
+		if (get_varint(&rd[3], &zz) != 0) {
+			return -1;
+		}
+		recs[i].value = prev_value = unzigzag(zz, prev_value);
+	}
+
+	return nb;
+}
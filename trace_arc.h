@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_ARC_H
+#define TRACE_ARC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace.h"
+#include "trace_index.h"
+
+#define TRACE_ARC_MAGIC		"VDEARC2"
+
+/*
+ * Columnar trace archive, all integers are little-endian.
+ *
+ *	header:		magic[8], u32 version, u32 block_records,
+ *			u64 records_nb, u64 directory offset,
+ *			u32 tail length, tail[12] (trailing partial record)
+ *	blocks:		u32 records_nb, u32 length of each of 4 columns,
+ *			src column:   RLE (varint run, u8 raw src byte)
+ *			type column:  RLE (varint run, varint type)
+ *			addr column:  zigzag varint delta to the previous addr
+ *			value column: zigzag varint delta to the previous value
+ *	directory:	u64 blocks_nb, u64 frames_nb,
+ *			per block: u64 offset, struct trace_index_block fields
+ *			per frame: u64 first, u64 end
+ *
+ * Blocks hold TRACE_INDEX_BLOCK_RECORDS records, so the directory doubles
+ * as the query index of the archived trace.
+ */
+struct trace_arc {
+	const uint8_t *data;
+	size_t size;
+	uint64_t *offsets;
+	struct trace_index index;
+	const uint8_t *tail;
+	uint32_t tail_len;
+};
+
+int trace_arc_probe(const char *path);
+int trace_arc_open(struct trace_arc *arc, const char *path);
+void trace_arc_close(struct trace_arc *arc);
+int trace_arc_decode(const struct trace_arc *arc, uint64_t blk,
+		     struct trace_record *recs, uint8_t *src_bytes);
+int trace_arc_pack(const struct trace_file *trace, const char *path);
+
+#endif // TRACE_ARC_H
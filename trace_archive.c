@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "trace_arc.h"
+
+static void put_be32(uint8_t *p, uint32_t val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+static int pack(const char *in_path, const char *out_path)
+{
+	struct trace_file trace;
+	int ret;
+
+	if (trace_open(&trace, in_path) != 0) {
+		return -1;
+	}
+
+	ret = trace_arc_pack(&trace, out_path);
+	trace_close(&trace);
+
+	return ret;
+}
+
+static int unpack(const char *in_path, const char *out_path)
+{
+	struct trace_record recs[TRACE_INDEX_BLOCK_RECORDS];
+	uint8_t src_bytes[TRACE_INDEX_BLOCK_RECORDS];
+	uint8_t buf[TRACE_INDEX_BLOCK_RECORDS * TRACE_RECORD_SIZE];
+	struct trace_arc arc;
+	uint64_t blk, blocks_nb;
+	FILE *fp;
+	int nb, i;
+
+	if (trace_arc_open(&arc, in_path) != 0) {
+		return -1;
+	}
+
+	fp = fopen(out_path, "w");
+	if (fp == NULL) {
+		perror(out_path);
+		trace_arc_close(&arc);
+		return -1;
+	}
+
+	put_be32(buf, arc.index.version);
+	fwrite(buf, 1, TRACE_HEADER_SIZE, fp);
+
+	blocks_nb = arc.index.blocks_nb;
+
+	for (blk = 0; blk < blocks_nb; blk++) {
+		nb = trace_arc_decode(&arc, blk, recs, src_bytes);
+		if (nb < 0) {
+			fprintf(stderr, "%s: Block %" PRIu64 " is corrupted\n",
+				in_path, blk);
+			break;
+		}
+
+		for (i = 0; i < nb; i++) {
+			uint8_t *p = buf + i * TRACE_RECORD_SIZE;
+
+			p[0] = src_bytes[i];
+			put_be32(p + 1, recs[i].type);
+			put_be32(p + 5, recs[i].addr);
+			put_be32(p + 9, recs[i].value);
+		}
+
+		fwrite(buf, TRACE_RECORD_SIZE, nb, fp);
+	}
+
+	/* Partial record the trace was cut in */
+	if (blk == blocks_nb) {
+		fwrite(arc.tail, 1, arc.tail_len, fp);
+	}
+
+	trace_arc_close(&arc);
+
+	if (ferror(fp) != 0 || fclose(fp) != 0) {
+		perror(out_path);
+		return -1;
+	}
+
+	if (blk != blocks_nb) {
+		unlink(out_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int list(const char *path)
+{
+	struct trace_arc arc;
+	uint64_t raw_size;
+
+	if (trace_arc_open(&arc, path) != 0) {
+		return -1;
+	}
+
+	raw_size = TRACE_HEADER_SIZE + arc.index.records_nb * TRACE_RECORD_SIZE +
+		   arc.tail_len;
+
+	printf("version %u\n", arc.index.version);
+	printf("records %" PRIu64 "\n", arc.index.records_nb);
+	printf("blocks %" PRIu64 "\n", arc.index.blocks_nb);
+	printf("frames %" PRIu64 "\n", arc.index.frames_nb);
+	printf("size %zu (raw %" PRIu64 ", ratio %.2f)\n", arc.size, raw_size,
+	       (double)raw_size / arc.size);
+
+	trace_arc_close(&arc);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s -c trace.bin archive\n"
+			"       %s -x archive trace.bin\n"
+			"       %s -l archive\n"
+		"\t-c pack raw trace into columnar archive\n"
+		"\t-x unpack archive into raw trace\n"
+		"\t-l print archive summary\n", prog, prog, prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int mode = 0;
+	int ret;
+	int c;
+
+	while ((c = getopt(argc, argv, "cxl")) != -1) {
+		switch (c) {
+		case 'c':
+		case 'x':
+		case 'l':
+			mode = c;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	switch (mode) {
+	case 'c':
+		if (optind != argc - 2) {
+			usage(argv[0]);
+		}
+		ret = pack(argv[optind], argv[optind + 1]);
+		break;
+	case 'x':
+		if (optind != argc - 2) {
+			usage(argv[0]);
+		}
+		ret = unpack(argv[optind], argv[optind + 1]);
+		break;
+	case 'l':
+		if (optind != argc - 1) {
+			usage(argv[0]);
+		}
+		ret = list(argv[optind]);
+		break;
+	default:
+		usage(argv[0]);
+	}
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
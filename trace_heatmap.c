@@ -0,0 +1,504 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Per-register counters cover the CAR and VDE register windows */
+#define REGS_BASE	0x60000000
+#define REGS_END	0x60020000
+#define REGS_NB		((REGS_END - REGS_BASE) / 4)
+
+typedef uint64_t counters[TRACE_BLOCKS_NB][TRACE_TYPES_NB][TRACE_SRC_NB];
+
+struct reg_stat {
+	uint64_t accesses[TRACE_TYPES_NB][TRACE_SRC_NB];
+	uint64_t total;
+	uint64_t polls;		/* reads repeating the previous read */
+	uint64_t max_poll_run;
+};
+
+struct poll_state {
+	uint32_t addr;
+	uint64_t run;
+};
+
+static struct reg_stat *regs;
+static counters total;
+static counters frame;
+static uint64_t frame_records;
+static uint64_t frame_mmio_min = UINT64_MAX;
+static uint64_t frame_mmio_max;
+static uint64_t frame_mmio_sum;
+static struct poll_state poll[TRACE_SRC_NB];
+
+/*
+ * Sequential 32bit memory writes are counted as the MEMSET32 runs the
+ * converted logs show them as, the written records are counted aside.
+ */
+static struct trace_seq seq;
+static int seq_in_frame;
+static uint64_t memset_writes[TRACE_SRC_NB];
+
+static unsigned top_nb = 20;
+static int per_frame = 1;
+
+static int is_mmio_block(int block)
+{
+	return block != TRACE_BLOCK_DRAM && block != TRACE_BLOCK_IRAM &&
+	       block != TRACE_BLOCK_IRQ;
+}
+
+static int is_read(uint32_t type)
+{
+	return type == TRACE_READ32 || type == TRACE_READ32_ALT ||
+	       type == TRACE_READ16 || type == TRACE_READ8;
+}
+
+static uint64_t sum_block(counters c, int block, int types_mask)
+{
+	uint64_t sum = 0;
+	int type, src;
+
+	for (type = 0; type < TRACE_TYPES_NB; type++) {
+		if (!(types_mask & (1 << type))) {
+			continue;
+		}
+
+		for (src = 0; src < TRACE_SRC_NB; src++) {
+			sum += c[block][type][src];
+		}
+	}
+
+	return sum;
+}
+
+static uint64_t sum_mmio(counters c, int reads)
+{
+	uint64_t sum = 0;
+	int block, type;
+
+	for (block = 0; block < TRACE_BLOCKS_NB; block++) {
+		if (!is_mmio_block(block)) {
+			continue;
+		}
+
+		for (type = 0; type < TRACE_TYPES_NB; type++) {
+			if (reads >= 0 && is_read(type) != reads) {
+				continue;
+			}
+
+			sum += c[block][type][TRACE_ON_CPU];
+			sum += c[block][type][TRACE_ON_AVP];
+		}
+	}
+
+	return sum;
+}
+
+static void update_poll(const struct trace_record *rec, struct reg_stat *reg)
+{
+	struct poll_state *ps = &poll[rec->src];
+
+	if (rec->type != TRACE_READ32) {
+		ps->run = 0;
+		return;
+	}
+
+	if (ps->run != 0 && ps->addr == rec->addr) {
+		ps->run++;
+
+		if (reg != NULL) {
+			reg->polls++;
+
+			if (ps->run > reg->max_poll_run) {
+				reg->max_poll_run = ps->run;
+			}
+		}
+		return;
+	}
+
+	ps->addr = rec->addr;
+	ps->run = 1;
+}
+
+static void print_frame(uint32_t frame_id)
+{
+	uint64_t mmio = sum_mmio(frame, -1);
+	int block;
+
+	frame_mmio_sum += mmio;
+
+	if (mmio < frame_mmio_min) {
+		frame_mmio_min = mmio;
+	}
+
+	if (mmio > frame_mmio_max) {
+		frame_mmio_max = mmio;
+	}
+
+	if (!per_frame) {
+		return;
+	}
+
+	printf("frame %u: records %" PRIu64 " mmio %" PRIu64
+	       " (rd %" PRIu64 " wr %" PRIu64 ")",
+	       frame_id, frame_records, mmio,
+	       sum_mmio(frame, 1), sum_mmio(frame, 0));
+
+	for (block = 0; block < TRACE_BLOCKS_NB; block++) {
+		uint64_t cnt = sum_block(frame, block, ~0);
+
+		if (cnt) {
+			printf(" %s=%" PRIu64, trace_block_name(block), cnt);
+		}
+	}
+
+	printf("\n");
+}
+
+static void account_seq(void)
+{
+	struct trace_record rec = {
+		.type	= seq.count > 1 ? TRACE_MEMSET32 : TRACE_WRITE32,
+		.addr	= seq.addr,
+		.src	= seq.src,
+	};
+	int block = trace_record_block(&rec);
+
+	if (seq.count == 0) {
+		return;
+	}
+
+	total[block][rec.type][rec.src]++;
+
+	if (seq_in_frame) {
+		frame[block][rec.type][rec.src]++;
+	}
+
+	if (seq.count > 1) {
+		memset_writes[rec.src] += seq.count;
+	}
+
+	seq.count = 0;
+}
+
+static void account_record(const struct trace_record *rec,
+			   struct trace_frame_tracker *ft)
+{
+	struct reg_stat *reg = NULL;
+	int block = trace_record_block(rec);
+	int mergeable = trace_seq_mergeable(rec);
+	int in_frame;
+
+	/* Runs never cross the frame markers, they aren't mergeable */
+	if (!mergeable || !trace_seq_continues(&seq, rec)) {
+		account_seq();
+	}
+
+	if (!mergeable) {
+		total[block][rec->type][rec->src]++;
+	}
+
+	if (rec->type != TRACE_IRQ &&
+	    rec->addr >= REGS_BASE && rec->addr < REGS_END) {
+		reg = &regs[(rec->addr - REGS_BASE) / 4];
+		reg->accesses[rec->type][rec->src]++;
+		reg->total++;
+	}
+
+	update_poll(rec, reg);
+
+	in_frame = trace_frame_update(ft, rec);
+
+	if (ft->started) {
+		memset(frame, 0, sizeof(frame));
+		frame_records = 0;
+	}
+
+	if (mergeable) {
+		if (seq.count == 0) {
+			trace_seq_start(&seq, rec);
+			seq_in_frame = in_frame;
+		} else {
+			seq.count++;
+		}
+	} else if (in_frame) {
+		frame[block][rec->type][rec->src]++;
+	}
+
+	frame_records += in_frame;
+
+	if (ft->ended) {
+		print_frame(ft->frames_nb - 1);
+		memset(frame, 0, sizeof(frame));
+		frame_records = 0;
+	}
+}
+
+static void print_totals(uint64_t records_nb, uint32_t frames_nb)
+{
+	int block, type;
+
+	printf("\nrecords %" PRIu64 " frames %u mmio %" PRIu64
+	       " (rd %" PRIu64 " wr %" PRIu64 ")\n",
+	       records_nb, frames_nb, sum_mmio(total, -1),
+	       sum_mmio(total, 1), sum_mmio(total, 0));
+
+	if (frames_nb) {
+		printf("mmio per frame: min %" PRIu64 " avg %" PRIu64
+		       " max %" PRIu64 "\n", frame_mmio_min,
+		       frame_mmio_sum / frames_nb, frame_mmio_max);
+	}
+
+	printf("\n%-8s %-10s %12s %12s\n", "block", "type", "ON_CPU", "ON_AVP");
+
+	for (block = 0; block < TRACE_BLOCKS_NB; block++) {
+		for (type = 0; type < TRACE_TYPES_NB; type++) {
+			uint64_t cpu = total[block][type][TRACE_ON_CPU];
+			uint64_t avp = total[block][type][TRACE_ON_AVP];
+
+			if (cpu == 0 && avp == 0) {
+				continue;
+			}
+
+			printf("%-8s %-10s %12" PRIu64 " %12" PRIu64 "\n",
+			       trace_block_name(block), trace_type_name(type),
+			       cpu, avp);
+		}
+	}
+
+	printf("MEMSET32 runs cover %" PRIu64 " ON_CPU and %" PRIu64
+	       " ON_AVP WRITE32 records\n", memset_writes[TRACE_ON_CPU],
+	       memset_writes[TRACE_ON_AVP]);
+}
+
+static int cmp_total(const void *a, const void *b)
+{
+	const struct reg_stat *ra = regs + *(const uint32_t *)a;
+	const struct reg_stat *rb = regs + *(const uint32_t *)b;
+
+	if (ra->total != rb->total) {
+		return ra->total < rb->total ? 1 : -1;
+	}
+
+	return *(const uint32_t *)a - *(const uint32_t *)b;
+}
+
+static int cmp_polls(const void *a, const void *b)
+{
+	const struct reg_stat *ra = regs + *(const uint32_t *)a;
+	const struct reg_stat *rb = regs + *(const uint32_t *)b;
+
+	if (ra->polls != rb->polls) {
+		return ra->polls < rb->polls ? 1 : -1;
+	}
+
+	return cmp_total(a, b);
+}
+
+static void print_top(const char *title, uint32_t *ids, unsigned ids_nb,
+		      int (*cmp)(const void *, const void *))
+{
+	unsigned i;
+
+	qsort(ids, ids_nb, sizeof(*ids), cmp);
+
+	printf("\n%s:\n", title);
+	printf("%-10s %-40s %10s %10s %10s %10s %8s\n", "addr", "name",
+	       "total", "reads", "writes", "polls", "max_run");
+
+	for (i = 0; i < ids_nb && i < top_nb; i++) {
+		const struct reg_stat *reg = &regs[ids[i]];
+		uint32_t addr = REGS_BASE + ids[i] * 4;
+		uint64_t reads = 0, writes = 0;
+		int type;
+
+		if (cmp == cmp_polls && reg->polls == 0) {
+			break;
+		}
+
+		for (type = 0; type < TRACE_TYPES_NB; type++) {
+			uint64_t cnt = reg->accesses[type][TRACE_ON_CPU] +
+				       reg->accesses[type][TRACE_ON_AVP];
+
+			if (is_read(type)) {
+				reads += cnt;
+			} else {
+				writes += cnt;
+			}
+		}
+
+		printf("0x%08X %-40s %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+		       " %10" PRIu64 " %8" PRIu64 "\n", addr,
+		       trace_reg_name(addr), reg->total, reads, writes,
+		       reg->polls, reg->max_poll_run);
+	}
+}
+
+static void print_registers(void)
+{
+	uint32_t *ids = malloc(REGS_NB * sizeof(*ids));
+	unsigned ids_nb = 0;
+	uint32_t i;
+
+	assert(ids != NULL);
+
+	for (i = 0; i < REGS_NB; i++) {
+		if (regs[i].total) {
+			ids[ids_nb++] = i;
+		}
+	}
+
+	print_top("Hottest registers", ids, ids_nb, cmp_total);
+	print_top("Most polled registers", ids, ids_nb, cmp_polls);
+
+	free(ids);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n top_nb] [-q] "
+		"trace.bin|fifo|unix:socket|-\n"
+		"\t-n number of registers in the top lists (default 20)\n"
+		"\t-q don't print per-frame statistics\n"
+		"A trace being recorded is read as a stream, the frames\n"
+		"statistics are printed as their SXE interrupt arrives.\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static int account_record_checked(const struct trace_record *rec,
+				  struct trace_frame_tracker *ft)
+{
+	if (rec->type >= TRACE_TYPES_NB) {
+		fprintf(stderr, "Wrong record type %u\n", rec->type);
+		return -1;
+	}
+
+	account_record(rec, ft);
+
+	return 0;
+}
+
+static uint64_t account_file(const char *path,
+			     struct trace_frame_tracker *ft)
+{
+	struct trace_record rec;
+	struct trace_file trace;
+	uint64_t i, records_nb;
+
+	if (trace_open(&trace, path) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < trace.records_nb; i++) {
+		trace_get_record(&trace, i, &rec);
+
+		if (account_record_checked(&rec, ft) != 0) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	records_nb = trace.records_nb;
+	trace_close(&trace);
+
+	return records_nb;
+}
+
+static uint64_t account_stream(const char *path,
+			       struct trace_frame_tracker *ft)
+{
+	static struct trace_stream stream;
+	struct trace_record rec;
+	uint32_t frames_nb = 0;
+	int ret;
+
+	if (trace_stream_open(&stream, path) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	while ((ret = trace_stream_next(&stream, &rec)) > 0) {
+		if (account_record_checked(&rec, ft) != 0) {
+			exit(EXIT_FAILURE);
+		}
+
+		/* Keep up with the capture when piped */
+		if (ft->frames_nb != frames_nb) {
+			frames_nb = ft->frames_nb;
+			fflush(stdout);
+		}
+	}
+
+	if (ret < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	trace_stream_close(&stream);
+
+	return stream.records_nb;
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_frame_tracker ft;
+	uint64_t records_nb;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:q")) != -1) {
+		switch (c) {
+		case 'n':
+			top_nb = atoi(optarg);
+			break;
+		case 'q':
+			per_frame = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+	}
+
+	regs = calloc(REGS_NB, sizeof(*regs));
+	assert(regs != NULL);
+
+	trace_frame_init(&ft);
+
+	if (trace_is_stream(argv[optind])) {
+		records_nb = account_stream(argv[optind], &ft);
+	} else {
+		records_nb = account_file(argv[optind], &ft);
+	}
+
+	account_seq();
+
+	print_totals(records_nb, ft.frames_nb);
+	print_registers();
+
+	free(regs);
+
+	return 0;
+}
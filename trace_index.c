@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace_index.h"
+
+/*
+ * Index file is a host-endian cache next to the trace: the header, then
+ * the block summaries, then the frame ranges. The trace size and mtime
+ * tell a stale index apart, another capture may have the same length.
+ */
+struct trace_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t block_records;
+	uint64_t trace_size;
+	int64_t trace_mtime_ns;
+	uint64_t records_nb;
+	uint64_t blocks_nb;
+	uint64_t frames_nb;
+};
+
+void trace_index_init(struct trace_index *idx, const struct trace_file *trace)
+{
+	uint64_t i;
+
+	memset(idx, 0, sizeof(*idx));
+
+	idx->version = trace->version;
+	idx->trace_size = trace->size;
+	idx->trace_mtime_ns = trace->mtime_ns;
+	idx->records_nb = trace->records_nb;
+	idx->blocks_nb = (trace->records_nb + TRACE_INDEX_BLOCK_RECORDS - 1) /
+				TRACE_INDEX_BLOCK_RECORDS;
+
+	idx->blocks = malloc(idx->blocks_nb * sizeof(*idx->blocks) + 1);
+	assert(idx->blocks != NULL);
+
+	for (i = 0; i < idx->blocks_nb; i++) {
+		idx->blocks[i].blocks_mask = 0;
+		idx->blocks[i].types_mask = 0;
+		idx->blocks[i].src_mask = 0;
+		idx->blocks[i].addr_min = UINT32_MAX;
+		idx->blocks[i].addr_max = 0;
+	}
+
+	trace_frame_init(&idx->ft);
+}
+
+void trace_index_free(struct trace_index *idx)
+{
+	free(idx->blocks);
+	free(idx->frames);
+}
+
+/* Blocks are independent, so different blocks can be filled concurrently */
+void trace_index_account(struct trace_index *idx, uint64_t rec_idx,
+			 const struct trace_record *rec)
+{
+	struct trace_index_block *blk;
+
+	blk = &idx->blocks[rec_idx / TRACE_INDEX_BLOCK_RECORDS];
+	blk->blocks_mask |= 1u << trace_record_block(rec);
+	blk->types_mask |= 1u << rec->type;
+	blk->src_mask |= 1u << rec->src;
+
+	if (rec->addr < blk->addr_min) {
+		blk->addr_min = rec->addr;
+	}
+
+	if (rec->addr > blk->addr_max) {
+		blk->addr_max = rec->addr;
+	}
+}
+
+/* Must be called in the trace order, at least for every frame marker */
+void trace_index_frame_update(struct trace_index *idx, uint64_t rec_idx,
+			      const struct trace_record *rec)
+{
+	int state = idx->ft.state;
+
+	trace_frame_update(&idx->ft, rec);
+
+	if (idx->ft.started) {
+		idx->frame_first = rec_idx + 1;
+		return;
+	}
+
+	if (state == TRACE_FRAME_ACTIVE &&
+	    idx->ft.state == TRACE_FRAME_TRIMMED) {
+		idx->frame_end = rec_idx;
+		return;
+	}
+
+	if (!idx->ft.ended) {
+		return;
+	}
+
+	if (state == TRACE_FRAME_ACTIVE) {
+		idx->frame_end = rec_idx + 1;
+	}
+
+	if (idx->frames_nb == idx->frames_size) {
+		idx->frames_size = idx->frames_size * 2 + 64;
+		idx->frames = realloc(idx->frames,
+				      idx->frames_size * sizeof(*idx->frames));
+		assert(idx->frames != NULL);
+	}
+
+	idx->frames[idx->frames_nb].first = idx->frame_first;
+	idx->frames[idx->frames_nb].end = idx->frame_end;
+	idx->frames_nb++;
+}
+
+/* Checks that the blocks and frames describe records_nb records */
+int trace_index_valid(const struct trace_index *idx)
+{
+	uint64_t i;
+
+	if (idx->blocks_nb != (idx->records_nb + TRACE_INDEX_BLOCK_RECORDS - 1) /
+				TRACE_INDEX_BLOCK_RECORDS ||
+	    idx->frames_nb > idx->records_nb) {
+		return 0;
+	}
+
+	for (i = 0; i < idx->frames_nb; i++) {
+		if (idx->frames[i].first > idx->frames[i].end ||
+		    idx->frames[i].end > idx->records_nb) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+void trace_index_build(struct trace_index *idx, const struct trace_file *trace)
+{
+	struct trace_record rec;
+	uint64_t i;
+
+	trace_index_init(idx, trace);
+
+	for (i = 0; i < trace->records_nb; i++) {
+		trace_get_record(trace, i, &rec);
+
+		if (rec.type >= TRACE_TYPES_NB) {
+			continue;
+		}
+
+		trace_index_account(idx, i, &rec);
+
+		if (trace_frame_marker(&rec)) {
+			trace_index_frame_update(idx, i, &rec);
+		}
+	}
+}
+
+int trace_index_write(const struct trace_index *idx, const char *path)
+{
+	struct trace_index_header hdr = {
+		.magic		= TRACE_INDEX_MAGIC,
+		.version	= idx->version,
+		.block_records	= TRACE_INDEX_BLOCK_RECORDS,
+		.trace_size	= idx->trace_size,
+		.trace_mtime_ns	= idx->trace_mtime_ns,
+		.records_nb	= idx->records_nb,
+		.blocks_nb	= idx->blocks_nb,
+		.frames_nb	= idx->frames_nb,
+	};
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(idx->blocks, sizeof(*idx->blocks), idx->blocks_nb, fp);
+	fwrite(idx->frames, sizeof(*idx->frames), idx->frames_nb, fp);
+
+	if (ferror(fp) != 0 || fclose(fp) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns -1 if index is missing or doesn't describe the trace */
+int trace_index_read(struct trace_index *idx, const struct trace_file *trace,
+		     const char *path)
+{
+	struct trace_index_header hdr;
+	FILE *fp;
+	int ret = -1;
+
+	memset(idx, 0, sizeof(*idx));
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return -1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, TRACE_INDEX_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.version != trace->version ||
+	    hdr.block_records != TRACE_INDEX_BLOCK_RECORDS ||
+	    hdr.trace_size != trace->size ||
+	    hdr.trace_mtime_ns != trace->mtime_ns ||
+	    hdr.records_nb != trace->records_nb ||
+	    hdr.blocks_nb != (hdr.records_nb + TRACE_INDEX_BLOCK_RECORDS - 1) /
+				TRACE_INDEX_BLOCK_RECORDS ||
+	    hdr.frames_nb > hdr.records_nb) {
+		goto out;
+	}
+
+	idx->version = hdr.version;
+	idx->trace_size = hdr.trace_size;
+	idx->trace_mtime_ns = hdr.trace_mtime_ns;
+	idx->records_nb = hdr.records_nb;
+	idx->blocks_nb = hdr.blocks_nb;
+	idx->frames_nb = hdr.frames_nb;
+	idx->frames_size = hdr.frames_nb;
+
+	idx->blocks = malloc(hdr.blocks_nb * sizeof(*idx->blocks) + 1);
+	idx->frames = malloc(hdr.frames_nb * sizeof(*idx->frames) + 1);
+	assert(idx->blocks != NULL && idx->frames != NULL);
+
+	if (fread(idx->blocks, sizeof(*idx->blocks), hdr.blocks_nb, fp) !=
+			hdr.blocks_nb ||
+	    fread(idx->frames, sizeof(*idx->frames), hdr.frames_nb, fp) !=
+			hdr.frames_nb ||
+	    !trace_index_valid(idx)) {
+		trace_index_free(idx);
+		memset(idx, 0, sizeof(*idx));
+		goto out;
+	}
+
+	ret = 0;
+out:
+	fclose(fp);
+
+	return ret;
+}
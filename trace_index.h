@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_INDEX_H
+#define TRACE_INDEX_H
+
+#include <stdint.h>
+
+#include "trace.h"
+
+#define TRACE_INDEX_MAGIC		"VDEIDX2"
+#define TRACE_INDEX_BLOCK_RECORDS	4096
+
+/* Summary of TRACE_INDEX_BLOCK_RECORDS consecutive records */
+struct trace_index_block {
+	uint32_t blocks_mask;
+	uint16_t types_mask;
+	uint16_t src_mask;
+	uint32_t addr_min;
+	uint32_t addr_max;
+};
+
+/* Records [first, end) are the frame content */
+struct trace_index_frame {
+	uint64_t first;
+	uint64_t end;
+};
+
+struct trace_index {
+	uint32_t version;
+	uint64_t trace_size;	/* identify the indexed trace file */
+	int64_t trace_mtime_ns;
+	uint64_t records_nb;
+	uint64_t blocks_nb;
+	uint64_t frames_nb;
+	struct trace_index_block *blocks;
+	struct trace_index_frame *frames;
+
+	/* frames builder */
+	struct trace_frame_tracker ft;
+	uint64_t frame_first;
+	uint64_t frame_end;
+	uint64_t frames_size;
+};
+
+static inline int trace_frame_marker(const struct trace_record *rec)
+{
+	if (rec->type == TRACE_IRQ) {
+		return rec->addr == TRACE_FRAME_IRQ;
+	}
+
+	return rec->addr == TRACE_FRAME_RESET_ADDR ||
+	       rec->addr == TRACE_FRAME_TRIM_ADDR;
+}
+
+void trace_index_init(struct trace_index *idx, const struct trace_file *trace);
+void trace_index_free(struct trace_index *idx);
+void trace_index_account(struct trace_index *idx, uint64_t rec_idx,
+			 const struct trace_record *rec);
+void trace_index_frame_update(struct trace_index *idx, uint64_t rec_idx,
+			      const struct trace_record *rec);
+int trace_index_valid(const struct trace_index *idx);
+void trace_index_build(struct trace_index *idx, const struct trace_file *trace);
+int trace_index_write(const struct trace_index *idx, const char *path);
+int trace_index_read(struct trace_index *idx, const struct trace_file *trace,
+		     const char *path);
+
+#endif // TRACE_INDEX_H
@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Converts an IO trace while it is being recorded.
+ *
+ * The reader thread decodes records coming from a FIFO or a Unix socket
+ * into a single-producer single-consumer ring, the main thread converts
+ * them to text like trace_to_txt does and writes out every frame as soon
+ * as its SXE interrupt arrives, announcing it on stdout for the tools
+ * following the capture.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define RING_RECORDS		(1 << 16)	/* power of 2 */
+#define READ_SIZE		(TRACE_RECORD_SIZE * 4096)
+
+/*
+ * Head is written only by the reader and tail only by the converter, the
+ * other side reads them with acquire semantics, so records are published
+ * without locks.
+ */
+struct ring {
+	struct trace_record recs[RING_RECORDS];
+	uint64_t head;
+	uint64_t tail;
+	int done;
+};
+
+struct frame_buf {
+	char *data;
+	size_t len;
+	size_t size;
+	uint64_t records_nb;
+};
+
+static struct ring ring;
+static const char *src_path;
+static const char *raw_path;
+static const char *frames_dir;
+static int in_fd = -1;
+static int read_error;
+static uint32_t version;
+
+static void backoff(unsigned *spins)
+{
+	struct timespec ts = { 0, 200000 };
+
+	if (++*spins < 64) {
+		return;
+	}
+
+	nanosleep(&ts, NULL);
+}
+
+static void ring_push(const struct trace_record *recs, unsigned nb)
+{
+	uint64_t head = ring.head;
+	unsigned spins = 0;
+	unsigned i;
+
+	for (i = 0; i < nb; i++, head++) {
+		while (head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) ==
+		       RING_RECORDS) {
+			__atomic_store_n(&ring.head, head, __ATOMIC_RELEASE);
+			backoff(&spins);
+		}
+
+		ring.recs[head & (RING_RECORDS - 1)] = recs[i];
+	}
+
+	__atomic_store_n(&ring.head, head, __ATOMIC_RELEASE);
+}
+
+static void * reader(void *arg)
+{
+	struct trace_record recs[READ_SIZE / TRACE_RECORD_SIZE];
+	uint8_t buf[READ_SIZE + TRACE_RECORD_SIZE];
+	size_t len = 0, hdr = TRACE_HEADER_SIZE;
+	FILE *raw_fp = NULL;
+	unsigned nb, i;
+	ssize_t ret;
+
+	(void)arg;
+
+	if (raw_path != NULL) {
+		raw_fp = fopen(raw_path, "w");
+		if (raw_fp == NULL) {
+			perror(raw_path);
+			read_error = 1;
+			goto out;
+		}
+	}
+
+	for (;;) {
+		ret = read(in_fd, buf + len, READ_SIZE - len);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (ret < 0) {
+			perror(src_path);
+			read_error = 1;
+			break;
+		}
+
+		if (ret == 0) {
+			break;
+		}
+
+		if (raw_fp != NULL) {
+			fwrite(buf + len, 1, ret, raw_fp);
+		}
+
+		len += ret;
+
+		if (hdr != 0) {
+			if (len < TRACE_HEADER_SIZE) {
+				continue;
+			}
+
+			version = trace_be32(buf);
+
+			if (!trace_version_valid(version)) {
+				fprintf(stderr, "%s: Record version mismatch %u\n",
+					src_path, version);
+				read_error = 1;
+				break;
+			}
+
+			memmove(buf, buf + hdr, len - hdr);
+			len -= hdr;
+			hdr = 0;
+		}
+
+		nb = len / TRACE_RECORD_SIZE;
+
+		for (i = 0; i < nb; i++) {
+			trace_decode(buf + i * TRACE_RECORD_SIZE, &recs[i]);
+		}
+
+		ring_push(recs, nb);
+
+		len -= nb * TRACE_RECORD_SIZE;
+		memmove(buf, buf + nb * TRACE_RECORD_SIZE, len);
+	}
+
+	if (len != 0 && !read_error) {
+		fprintf(stderr, "%s: Trailing partial record dropped\n",
+			src_path);
+	}
+
+	if (raw_fp != NULL && (ferror(raw_fp) != 0 || fclose(raw_fp) != 0)) {
+		perror(raw_path);
+		read_error = 1;
+	}
+out:
+	__atomic_store_n(&ring.done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+static void frame_put(struct frame_buf *fb, const char *line, int len)
+{
+	if (fb->len + len > fb->size) {
+		fb->size = (fb->len + len) * 2;
+		fb->data = realloc(fb->data, fb->size);
+		assert(fb->data != NULL);
+	}
+
+	memcpy(fb->data + fb->len, line, len);
+	fb->len += len;
+}
+
+static int frame_write(struct frame_buf *fb, uint32_t frame_id)
+{
+	char path[4096];
+	FILE *fp;
+
+	if (frames_dir == NULL) {
+		printf("frame %u: records %" PRIu64 "\n", frame_id,
+		       fb->records_nb);
+		fflush(stdout);
+		return 0;
+	}
+
+	snprintf(path, sizeof(path), "%s/%u", frames_dir, frame_id);
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	fwrite(fb->data, 1, fb->len, fp);
+
+	if (ferror(fp) != 0 || fclose(fp) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	printf("frame %u: records %" PRIu64 " %s\n", frame_id,
+	       fb->records_nb, path);
+	fflush(stdout);
+
+	return 0;
+}
+
+struct converter {
+	FILE *fp;
+	struct trace_frame_tracker ft;
+	struct frame_buf frame;
+	struct trace_seq seq;
+	int seq_in_frame;
+};
+
+static void put_line(struct converter *cv, const char *line, int len,
+		     int in_frame)
+{
+	if (cv->fp != NULL) {
+		fwrite(line, 1, len, cv->fp);
+	}
+
+	if (in_frame) {
+		frame_put(&cv->frame, line, len);
+	}
+}
+
+static void put_seq(struct converter *cv)
+{
+	char line[TRACE_LINE_MAX];
+
+	if (cv->seq.count == 0) {
+		return;
+	}
+
+	put_line(cv, line, trace_format_seq(line, &cv->seq), cv->seq_in_frame);
+	cv->seq.count = 0;
+}
+
+static int convert(struct converter *cv, const struct trace_record *rec)
+{
+	char line[TRACE_LINE_MAX];
+	int in_frame, len;
+
+	if (rec->type >= TRACE_TYPES_NB) {
+		fprintf(stderr, "Wrong record type %u\n", rec->type);
+		return -1;
+	}
+
+	in_frame = trace_frame_update(&cv->ft, rec);
+
+	/* Frame files match split.pl ones, starting with a newline */
+	if (cv->ft.started) {
+		cv->frame.len = 0;
+		cv->frame.records_nb = 0;
+		frame_put(&cv->frame, "\n", 1);
+	}
+
+	cv->frame.records_nb += in_frame;
+
+	/* Runs never cross the frame markers, they aren't mergeable */
+	if (trace_seq_mergeable(rec)) {
+		if (trace_seq_continues(&cv->seq, rec)) {
+			cv->seq.count++;
+			return 0;
+		}
+
+		put_seq(cv);
+		trace_seq_start(&cv->seq, rec);
+		cv->seq_in_frame = in_frame;
+		return 0;
+	}
+
+	put_seq(cv);
+
+	len = trace_format_record(line, rec, 0);
+	if (len < 0) {
+		fprintf(stderr, "Bad IRQ number %u\n", rec->addr);
+		return -1;
+	}
+
+	put_line(cv, line, len, in_frame);
+
+	if (cv->ft.ended) {
+		if (cv->fp != NULL) {
+			fflush(cv->fp);
+		}
+
+		/* split.pl cuts an untrimmed frame right after "INT_VDE_SXE" */
+		if (in_frame) {
+			cv->frame.len--;
+		}
+
+		if (frame_write(&cv->frame, cv->ft.frames_nb - 1) != 0) {
+			return -1;
+		}
+
+		cv->frame.len = 0;
+		cv->frame.records_nb = 0;
+	}
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-o out.txt] [-b raw.bin] [-f frames_dir] "
+		"fifo|unix:socket|-\n"
+		"\t-o text output, trace_to_txt format\n"
+		"\t-b copy of the raw stream\n"
+		"\t-f directory for the per-frame text files\n"
+		"Completed frames are announced on stdout.\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct converter cv = { 0 };
+	const char *out_path = NULL;
+	uint64_t head, tail = 0;
+	unsigned spins = 0;
+	pthread_t thread;
+	int err = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "o:b:f:")) != -1) {
+		switch (c) {
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'b':
+			raw_path = optarg;
+			break;
+		case 'f':
+			frames_dir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+	}
+
+	src_path = argv[optind];
+
+	if (out_path != NULL) {
+		cv.fp = fopen(out_path, "w");
+		if (cv.fp == NULL) {
+			perror(out_path);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	in_fd = trace_stream_connect(src_path);
+	if (in_fd < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	trace_frame_init(&cv.ft);
+
+	err = pthread_create(&thread, NULL, reader, NULL);
+	assert(err == 0);
+
+	for (;;) {
+		int done = __atomic_load_n(&ring.done, __ATOMIC_ACQUIRE);
+
+		head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+
+		if (head == tail) {
+			if (done) {
+				break;
+			}
+
+			backoff(&spins);
+			continue;
+		}
+
+		spins = 0;
+
+		for (; tail != head && !err; tail++) {
+			err = convert(&cv, &ring.recs[tail & (RING_RECORDS - 1)]);
+		}
+
+		__atomic_store_n(&ring.tail, tail, __ATOMIC_RELEASE);
+
+		if (err) {
+			/* Reader is stuck on the full ring otherwise */
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_join(thread, NULL);
+
+	/*
+	 * bin_to_txt.pl never flushes the run pending at the end of the
+	 * trace, the output is kept identical to it.
+	 */
+
+	if (cv.fp != NULL && (ferror(cv.fp) != 0 || fclose(cv.fp) != 0)) {
+		perror(out_path);
+		err = 1;
+	}
+
+	free(cv.frame.data);
+
+	return (err || read_error) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Memory contents at any frame, rebuilt from the writes of an IO trace.
+ *
+ * The address space is a radix tree of 4K pages, only the touched pages
+ * exist. At the end of every frame the tree root is kept as the frame
+ * snapshot and the next write to a page copies the page and the path to
+ * it (copy-on-write), so unchanged pages are shared by all the snapshots
+ * and memory grows with the pages written per frame. Every page carries
+ * a bitmap of the bytes ever written, the others are unknown.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	(1u << PAGE_SHIFT)
+#define LEVEL_BITS	5
+#define LEVELS		((32 - PAGE_SHIFT) / LEVEL_BITS)
+#define NODE_SLOTS	(1u << LEVEL_BITS)
+
+#define FRAME_END	UINT32_MAX	/* state at the end of the trace */
+#define ADDR_SPACE	(1ull << 32)
+
+struct page {
+	uint32_t epoch;
+	uint8_t valid[PAGE_SIZE / 8];
+	uint8_t data[PAGE_SIZE];
+};
+
+struct node {
+	uint32_t epoch;
+	void *slot[NODE_SLOTS];
+};
+
+struct memimage {
+	struct node *root;
+	uint32_t epoch;		/* objects of older epochs are shared */
+	struct node **snaps;	/* root at the end of every frame */
+	uint32_t snaps_nb;
+	uint32_t snaps_size;
+	void **objs;		/* everything allocated, for freeing */
+	size_t objs_nb;
+	size_t objs_size;
+	size_t pages_nb;
+	size_t nodes_nb;
+};
+
+static void * img_alloc(struct memimage *img, const void *orig, size_t size)
+{
+	void *obj = malloc(size);
+
+	assert(obj != NULL);
+
+	if (orig != NULL) {
+		memcpy(obj, orig, size);
+	} else {
+		memset(obj, 0, size);
+	}
+
+	if (img->objs_nb == img->objs_size) {
+		img->objs_size = img->objs_size * 2 + 256;
+		img->objs = realloc(img->objs,
+				    img->objs_size * sizeof(*img->objs));
+		assert(img->objs != NULL);
+	}
+
+	img->objs[img->objs_nb++] = obj;
+
+	return obj;
+}
+
+static unsigned slot_index(uint32_t addr, int level)
+{
+	return (addr >> (32 - LEVEL_BITS * (level + 1))) & (NODE_SLOTS - 1);
+}
+
+/* Makes the path to the page private to the current epoch */
+static struct page * page_for_write(struct memimage *img, uint32_t addr)
+{
+	void **pp = (void **)&img->root;
+	struct node *node;
+	struct page *page;
+	int level;
+
+	for (level = 0; level < LEVELS; level++) {
+		node = *pp;
+
+		if (node == NULL || node->epoch != img->epoch) {
+			node = img_alloc(img, node, sizeof(*node));
+			node->epoch = img->epoch;
+			img->nodes_nb++;
+			*pp = node;
+		}
+
+		pp = &node->slot[slot_index(addr, level)];
+	}
+
+	page = *pp;
+
+	if (page == NULL || page->epoch != img->epoch) {
+		page = img_alloc(img, page, sizeof(*page));
+		page->epoch = img->epoch;
+		img->pages_nb++;
+		*pp = page;
+	}
+
+	return page;
+}
+
+static const struct page * page_lookup(const struct node *root, uint32_t addr)
+{
+	const struct node *node = root;
+	int level;
+
+	for (level = 0; level < LEVELS - 1 && node != NULL; level++) {
+		node = node->slot[slot_index(addr, level)];
+	}
+
+	if (node == NULL) {
+		return NULL;
+	}
+
+	return node->slot[slot_index(addr, LEVELS - 1)];
+}
+
+/*
+ * Little-endian, like both of the CPUs. MEMSET32 of the text traces is
+ * only a rendering of the WRITE32 runs, raw traces have the writes.
+ */
+static void img_write(struct memimage *img, uint32_t addr, uint32_t value,
+		      unsigned size)
+{
+	struct page *page = NULL;
+	uint32_t off;
+	unsigned i;
+
+	for (i = 0; i < size; i++, addr++, value >>= 8) {
+		off = addr & (PAGE_SIZE - 1);
+
+		if (page == NULL || off == 0) {
+			page = page_for_write(img, addr);
+		}
+
+		page->data[off] = value;
+		page->valid[off / 8] |= 1 << (off % 8);
+	}
+}
+
+static void img_snapshot(struct memimage *img)
+{
+	if (img->snaps_nb == img->snaps_size) {
+		img->snaps_size = img->snaps_size * 2 + 64;
+		img->snaps = realloc(img->snaps,
+				     img->snaps_size * sizeof(*img->snaps));
+		assert(img->snaps != NULL);
+	}
+
+	img->snaps[img->snaps_nb++] = img->root;
+	img->epoch++;
+}
+
+static void img_free(struct memimage *img)
+{
+	size_t i;
+
+	for (i = 0; i < img->objs_nb; i++) {
+		free(img->objs[i]);
+	}
+
+	free(img->objs);
+	free(img->snaps);
+}
+
+static int record_size(uint32_t type)
+{
+	switch (type) {
+	case TRACE_WRITE8:
+		return 1;
+	case TRACE_WRITE16:
+		return 2;
+	case TRACE_WRITE32:
+		return 4;
+	}
+
+	return 0;
+}
+
+static void build(struct memimage *img, const struct trace_file *trace)
+{
+	struct trace_frame_tracker ft;
+	struct trace_record rec;
+	uint64_t i;
+	int size;
+
+	trace_frame_init(&ft);
+
+	for (i = 0; i < trace->records_nb; i++) {
+		trace_get_record(trace, i, &rec);
+
+		size = record_size(rec.type);
+		if (size) {
+			img_write(img, rec.addr, rec.value, size);
+		}
+
+		trace_frame_update(&ft, &rec);
+
+		if (ft.ended) {
+			img_snapshot(img);
+		}
+	}
+}
+
+static const struct node * frame_root(const struct memimage *img,
+				      uint32_t frame)
+{
+	return frame == FRAME_END ? img->root : img->snaps[frame];
+}
+
+/* The dump stops at the end of the 32-bit address space */
+static void dump(const struct memimage *img, uint32_t frame, uint32_t addr,
+		 uint64_t len)
+{
+	const struct node *root = frame_root(img, frame);
+	const struct page *page = NULL;
+	uint64_t a, end = (uint64_t)addr + len;
+	uint32_t off;
+
+	if (len == 0) {
+		return;
+	}
+
+	if (end > ADDR_SPACE) {
+		end = ADDR_SPACE;
+	}
+
+	for (a = addr & ~15u; a < end; a++) {
+		off = a & (PAGE_SIZE - 1);
+
+		if (a == (addr & ~15u) || off == 0) {
+			page = page_lookup(root, a);
+		}
+
+		if (a % 16 == 0) {
+			printf("0x%08" PRIX64 ":", a);
+		}
+
+		if (a < addr) {
+			printf("   ");
+		} else if (page != NULL && (page->valid[off / 8] & (1 << (off % 8)))) {
+			printf(" %02X", page->data[off]);
+		} else {
+			printf(" ??");
+		}
+
+		if (a % 16 == 15 || a + 1 == end) {
+			printf("\n");
+		}
+	}
+}
+
+static int byte_equal(const struct page *a, const struct page *b,
+		      uint32_t off)
+{
+	int va = a != NULL && (a->valid[off / 8] & (1 << (off % 8)));
+	int vb = b != NULL && (b->valid[off / 8] & (1 << (off % 8)));
+
+	return va == vb && (!va || a->data[off] == b->data[off]);
+}
+
+static void diff_page(const struct page *a, const struct page *b,
+		      uint32_t base)
+{
+	uint32_t off, start = 0;
+	int in_run = 0;
+
+	for (off = 0; off <= PAGE_SIZE; off++) {
+		int same = off == PAGE_SIZE || byte_equal(a, b, off);
+
+		if (!same && !in_run) {
+			start = off;
+			in_run = 1;
+		} else if (same && in_run) {
+			printf("0x%08X-0x%08X\n", base + start, base + off - 1);
+			in_run = 0;
+		}
+	}
+}
+
+/* Subtrees shared by the two snapshots are skipped as a whole */
+static void diff_node(const struct node *a, const struct node *b, int level,
+		      uint32_t base)
+{
+	unsigned i;
+
+	if (a == b) {
+		return;
+	}
+
+	for (i = 0; i < NODE_SLOTS; i++) {
+		const void *sa = a ? a->slot[i] : NULL;
+		const void *sb = b ? b->slot[i] : NULL;
+		uint32_t addr = base | (i << (32 - LEVEL_BITS * (level + 1)));
+
+		if (sa == sb) {
+			continue;
+		}
+
+		if (level == LEVELS - 1) {
+			diff_page(sa, sb, addr);
+		} else {
+			diff_node(sa, sb, level + 1, addr);
+		}
+	}
+}
+
+static int parse_num(const char *str, uint64_t max, uint64_t *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtoull(str, &end, 0);
+
+	/* strtoull() negates a minus signed number instead of failing */
+	if (end == str || *end != '\0' || errno != 0 || *val > max ||
+	    str[0] == '-') {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int parse_frame(const char *str, uint32_t *frame)
+{
+	uint64_t val;
+
+	if (strcmp(str, "end") == 0) {
+		*frame = FRAME_END;
+		return 0;
+	}
+
+	if (parse_num(str, UINT32_MAX, &val) != 0) {
+		return -1;
+	}
+
+	*frame = val;
+
+	return 0;
+}
+
+/*
+ * "d FRAME ADDR [LEN]" dumps memory at the end of the frame, LEN is at
+ * most the 4G address space, "c FRAME_A FRAME_B" lists address ranges
+ * that differ between the two.
+ */
+static int run_query(const struct memimage *img, char *query)
+{
+	char *argv[5], *saveptr = NULL;
+	uint32_t frame_a, frame_b;
+	uint64_t addr, len = 16;
+	int argc = 0;
+
+	while (argc < 5) {
+		argv[argc] = strtok_r(argc ? NULL : query, " \t\n", &saveptr);
+		if (argv[argc] == NULL) {
+			break;
+		}
+		argc++;
+	}
+
+	if (argc == 0) {
+		return 0;
+	}
+
+	if (strcmp(argv[0], "d") == 0 && (argc == 3 || argc == 4) &&
+	    parse_frame(argv[1], &frame_a) == 0) {
+		if (parse_num(argv[2], UINT32_MAX, &addr) != 0) {
+			goto bad;
+		}
+
+		if (argc == 4 && parse_num(argv[3], ADDR_SPACE, &len) != 0) {
+			goto bad;
+		}
+
+		if (frame_a != FRAME_END && frame_a >= img->snaps_nb) {
+			fprintf(stderr, "No frame %u, the trace has %u\n",
+				frame_a, img->snaps_nb);
+			return -1;
+		}
+
+		dump(img, frame_a, addr, len);
+		return 0;
+	}
+
+	if (strcmp(argv[0], "c") == 0 && argc == 3 &&
+	    parse_frame(argv[1], &frame_a) == 0 &&
+	    parse_frame(argv[2], &frame_b) == 0) {
+		if ((frame_a != FRAME_END && frame_a >= img->snaps_nb) ||
+		    (frame_b != FRAME_END && frame_b >= img->snaps_nb)) {
+			fprintf(stderr, "No such frame, the trace has %u\n",
+				img->snaps_nb);
+			return -1;
+		}
+
+		diff_node(frame_root(img, frame_a), frame_root(img, frame_b),
+			  0, 0);
+		return 0;
+	}
+bad:
+	fprintf(stderr, "Bad query\n");
+	return -1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s] trace.bin [query...]\n"
+		"\t-s print the image statistics\n"
+		"Queries (read from stdin if none given), FRAME is a frame\n"
+		"number or \"end\", the state is taken at the INT_VDE_SXE IRQ\n"
+		"(IRQ 12, value 1) record that ends the frame:\n"
+		"\td FRAME ADDR [LEN]   dump memory, ?? for never written bytes\n"
+		"\tc FRAME_A FRAME_B    list address ranges that differ\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct memimage img = { 0 };
+	struct trace_file trace;
+	size_t line_size = 0;
+	char *line = NULL;
+	int stats = 0;
+	int err = 0;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "s")) != -1) {
+		switch (c) {
+		case 's':
+			stats = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+	}
+
+	if (trace_open(&trace, argv[optind]) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	build(&img, &trace);
+	trace_close(&trace);
+
+	if (stats) {
+		fprintf(stderr, "frames %u pages %zu nodes %zu memory %zu KiB\n",
+			img.snaps_nb, img.pages_nb, img.nodes_nb,
+			(img.pages_nb * sizeof(struct page) +
+			 img.nodes_nb * sizeof(struct node)) / 1024);
+	}
+
+	if (optind + 1 < argc) {
+		for (i = optind + 1; i < argc; i++) {
+			err |= run_query(&img, argv[i]);
+		}
+	} else {
+		while (getline(&line, &line_size, stdin) >= 0) {
+			err |= run_query(&img, line);
+			fflush(stdout);
+		}
+		free(line);
+	}
+
+	img_free(&img);
+
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Interleaves kernel logs with IO traces into a single view.
+ *
+ * Neither source has a clock the other one shares, so they are aligned on
+ * the frames: a trace frame spans from the VDE reset to the SXE interrupt,
+ * a log frame from the driver "+++" marker to the "---" one (the same split
+ * split.pl does). Every source is cut into segments, the gap before frame N
+ * is segment 2N and frame N itself is segment 2N + 1, and every item gets
+ * its relative position within its segment: by the dmesg timestamps when
+ * there are any, by the item index otherwise.
+ *
+ * The sources are then merged on (segment, position) like sorted runs.
+ * Only the current item of each source is held, segment lengths are found
+ * by scanning ahead and seeking back, so inputs must be regular files.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "trace.h"
+
+#define LOG_MARKER_LEN	46
+
+enum {
+	SRC_TRACE,
+	SRC_LOG,
+};
+
+struct source {
+	int kind;
+	const char *path;
+	int eof;
+	uint64_t seg;		/* segment of the current item */
+	double key;		/* position of the current item in the segment */
+	uint64_t pos;		/* current item index in the segment */
+	uint64_t len;		/* segment length, records or lines */
+
+	/* trace */
+	struct trace_file trace;
+	struct trace_frame_tracker ft;
+	uint64_t next;		/* next record */
+	struct trace_record rec;
+	struct trace_seq seq;	/* current item if it is a writes run */
+
+	/* log */
+	FILE *fp;
+	char *line;
+	size_t line_size;
+	const char *text;	/* current line without the printk prefix */
+	int in_frame;
+	uint64_t frames_nb;
+	double time;
+	double time_first;
+	double time_last;
+	int timed;		/* segment is positioned by the timestamps */
+};
+
+static char log_start_marker[LOG_MARKER_LEN + 1];
+static char log_end_marker[LOG_MARKER_LEN + 1];
+
+static uint64_t trace_segment(struct trace_frame_tracker *ft,
+			      const struct trace_record *rec)
+{
+	trace_frame_update(ft, rec);
+
+	if (ft->state != TRACE_FRAME_IDLE || ft->ended) {
+		return (ft->frames_nb - ft->ended) * 2ull + 1;
+	}
+
+	return ft->frames_nb * 2ull;
+}
+
+/* Finds the last record of the segment started by the current record */
+static void trace_scan_segment(struct source *src)
+{
+	struct trace_frame_tracker ft = src->ft;
+	struct trace_record rec;
+	uint64_t i;
+
+	for (i = src->next; i < src->trace.records_nb; i++) {
+		trace_get_record(&src->trace, i, &rec);
+
+		if (trace_segment(&ft, &rec) != src->seg) {
+			break;
+		}
+	}
+
+	src->len = i - src->next + 1;
+	src->pos = 0;
+}
+
+static void trace_next(struct source *src)
+{
+	uint64_t seg;
+
+	if (src->next == src->trace.records_nb) {
+		src->eof = 1;
+		return;
+	}
+
+	trace_get_record(&src->trace, src->next, &src->rec);
+	seg = trace_segment(&src->ft, &src->rec);
+	src->next++;
+
+	if (seg != src->seg || src->pos + 1 >= src->len) {
+		src->seg = seg;
+		trace_scan_segment(src);
+	} else {
+		src->pos++;
+	}
+
+	src->key = src->len > 1 ? (double)src->pos / (src->len - 1) : 0;
+	src->seq.count = 0;
+
+	if (!trace_seq_mergeable(&src->rec)) {
+		return;
+	}
+
+	/* Runs never cross a segment, frame markers aren't mergeable */
+	trace_seq_start(&src->seq, &src->rec);
+
+	while (src->pos + 1 < src->len) {
+		struct trace_record rec;
+
+		trace_get_record(&src->trace, src->next, &rec);
+
+		if (!trace_seq_continues(&src->seq, &rec)) {
+			break;
+		}
+
+		trace_segment(&src->ft, &rec);
+		src->seq.count++;
+		src->next++;
+		src->pos++;
+	}
+}
+
+/* Strips "<6>[  123.456789] " prefix of the raw dmesg, returns the time */
+static const char * log_parse(const char *line, double *time, int *timed)
+{
+	const char *p = line;
+	char *end;
+	double t;
+
+	*timed = 0;
+
+	if (*p == '<') {
+		p = strchr(p, '>');
+		if (p == NULL) {
+			return line;
+		}
+		p++;
+	}
+
+	if (*p != '[') {
+		return line;
+	}
+
+	t = strtod(p + 1, &end);
+	if (end == p + 1 || *end != ']') {
+		return line;
+	}
+
+	*time = t;
+	*timed = 1;
+
+	return end[1] == ' ' ? end + 2 : end + 1;
+}
+
+static uint64_t log_segment(struct source *src, const char *line)
+{
+	if (strstr(line, log_start_marker) != NULL) {
+		src->in_frame = 1;
+	} else if (strstr(line, log_end_marker) != NULL && src->in_frame) {
+		src->in_frame = 0;
+		src->frames_nb++;
+
+		return (src->frames_nb - 1) * 2 + 1;
+	}
+
+	return src->frames_nb * 2 + src->in_frame;
+}
+
+static int log_read(struct source *src, char **line, size_t *line_size)
+{
+	ssize_t len = getline(line, line_size, src->fp);
+
+	if (len < 0) {
+		if (ferror(src->fp)) {
+			perror(src->path);
+			exit(EXIT_FAILURE);
+		}
+		return 0;
+	}
+
+	while (len > 0 && ((*line)[len - 1] == '\n' ||
+			   (*line)[len - 1] == '\r')) {
+		(*line)[--len] = '\0';
+	}
+
+	return 1;
+}
+
+/*
+ * Counts lines of the segment started by the current line and its time
+ * span, then rewinds to the line following the current one. The span is
+ * only used if the first line has its own timestamp.
+ */
+static void log_scan_segment(struct source *src, int timed)
+{
+	int in_frame = src->in_frame;
+	uint64_t frames_nb = src->frames_nb;
+	off_t off = ftello(src->fp);
+	double time = src->time;
+	size_t line_size = 0;
+	char *line = NULL;
+	int line_timed;
+
+	src->time_first = src->time;
+	src->time_last = src->time;
+	src->len = 1;
+	src->pos = 0;
+
+	while (log_read(src, &line, &line_size) &&
+	       log_segment(src, line) == src->seg) {
+		log_parse(line, &time, &line_timed);
+		src->time_last = time;
+		src->len++;
+	}
+
+	free(line);
+
+	if (off < 0 || fseeko(src->fp, off, SEEK_SET) != 0) {
+		perror(src->path);
+		exit(EXIT_FAILURE);
+	}
+
+	src->in_frame = in_frame;
+	src->frames_nb = frames_nb;
+	src->timed = timed && src->time_last > src->time_first;
+}
+
+static void log_next(struct source *src)
+{
+	double key;
+	uint64_t seg;
+	int timed;
+
+	if (!log_read(src, &src->line, &src->line_size)) {
+		src->eof = 1;
+		return;
+	}
+
+	src->text = log_parse(src->line, &src->time, &timed);
+	seg = log_segment(src, src->line);
+
+	if (seg != src->seg || src->pos + 1 >= src->len) {
+		src->seg = seg;
+		log_scan_segment(src, timed);
+	} else {
+		src->pos++;
+	}
+
+	if (src->timed) {
+		key = (src->time - src->time_first) /
+			(src->time_last - src->time_first);
+	} else {
+		key = src->len > 1 ? (double)src->pos / (src->len - 1) : 0;
+	}
+
+	/* Timestamps of different CPUs may go slightly backwards */
+	if (src->pos == 0 || key > src->key) {
+		src->key = key > 1 ? 1 : key;
+	}
+}
+
+static void source_next(struct source *src)
+{
+	if (src->kind == SRC_TRACE) {
+		trace_next(src);
+	} else {
+		log_next(src);
+	}
+}
+
+static int source_open(struct source *src, const char *path)
+{
+	uint8_t hdr[TRACE_HEADER_SIZE];
+	FILE *fp;
+
+	memset(src, 0, sizeof(*src));
+	src->path = path;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	if (fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr) &&
+	    trace_version_valid(trace_be32(hdr))) {
+		fclose(fp);
+
+		if (trace_open(&src->trace, path) != 0) {
+			return -1;
+		}
+
+		src->kind = SRC_TRACE;
+		trace_frame_init(&src->ft);
+	} else {
+		if (fseeko(fp, 0, SEEK_SET) != 0) {
+			fprintf(stderr, "%s: Log must be a regular file\n",
+				path);
+			fclose(fp);
+			return -1;
+		}
+
+		src->kind = SRC_LOG;
+		src->fp = fp;
+	}
+
+	source_next(src);
+
+	return 0;
+}
+
+static void source_close(struct source *src)
+{
+	if (src->kind == SRC_TRACE) {
+		trace_close(&src->trace);
+	} else {
+		fclose(src->fp);
+		free(src->line);
+	}
+}
+
+/*
+ * On a tie the log goes first in the first half of a segment and last in
+ * the second one, so that the driver markers enclose the frame records.
+ */
+static int source_before(const struct source *a, const struct source *b)
+{
+	if (a->seg != b->seg) {
+		return a->seg < b->seg;
+	}
+
+	if (a->key != b->key) {
+		return a->key < b->key;
+	}
+
+	if (a->kind != b->kind) {
+		return (a->kind == SRC_LOG) == (a->key < 0.5);
+	}
+
+	return a < b;
+}
+
+static void source_print(struct source *src, FILE *fp)
+{
+	char line[TRACE_LINE_MAX];
+	int len;
+
+	if (src->kind == SRC_LOG) {
+		fprintf(fp, "DMESG:  %s\n", src->text);
+		return;
+	}
+
+	if (src->seq.count != 0) {
+		len = trace_format_seq(line, &src->seq);
+	} else {
+		len = trace_format_record(line, &src->rec, 0);
+	}
+
+	if (len < 0) {
+		fprintf(stderr, "%s: Can't describe record %" PRIu64 "\n",
+			src->path, src->next - 1);
+		exit(EXIT_FAILURE);
+	}
+
+	fwrite(line, 1, len, fp);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-o merged.txt] input...\n"
+		"\tinputs are raw IO traces and dmesg logs (raw or cleaned),\n"
+		"\taligned on the frame markers\n"
+		"\t-o output path (default stdout)\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	const char *out_path = NULL;
+	struct source *srcs, *min;
+	unsigned srcs_nb, i;
+	FILE *fp = stdout;
+	int c;
+
+	while ((c = getopt(argc, argv, "o:")) != -1) {
+		switch (c) {
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+	}
+
+	memset(log_start_marker, '+', LOG_MARKER_LEN);
+	memset(log_end_marker, '-', LOG_MARKER_LEN);
+
+	srcs_nb = argc - optind;
+	srcs = calloc(srcs_nb, sizeof(*srcs));
+	assert(srcs != NULL);
+
+	for (i = 0; i < srcs_nb; i++) {
+		if (source_open(&srcs[i], argv[optind + i]) != 0) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (out_path != NULL) {
+		fp = fopen(out_path, "w");
+		if (fp == NULL) {
+			perror(out_path);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (;;) {
+		min = NULL;
+
+		for (i = 0; i < srcs_nb; i++) {
+			if (!srcs[i].eof &&
+			    (min == NULL || source_before(&srcs[i], min))) {
+				min = &srcs[i];
+			}
+		}
+
+		if (min == NULL) {
+			break;
+		}
+
+		source_print(min, fp);
+		source_next(min);
+	}
+
+	for (i = 0; i < srcs_nb; i++) {
+		source_close(&srcs[i]);
+	}
+
+	free(srcs);
+
+	if (ferror(fp) != 0 || fclose(fp) != 0) {
+		perror(out_path ? out_path : "stdout");
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
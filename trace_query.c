@@ -0,0 +1,584 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Prints trace records matching a filter. Filter is a list of terms, all
+ * of which must match:
+ *
+ *	src=cpu|avp
+ *	type=read32,write32,...		record types (bin_to_txt.pl names)
+ *	engine=MBE,PPE,...		register blocks, IRQ for interrupts
+ *	addr=0x6001C000-0x6001C0FF,...	address (IRQ number) ranges
+ *	value=0x00000001[/0x0000000F]	value, optionally masked
+ *	frame=100-120			frames as split by split.pl
+ *
+ * Sequential identical 32bit memory writes are merged into MEMSET32 runs
+ * like trace_to_txt does, so type=write32 only matches the lone writes.
+ * With -m the frame marker records are printed whatever the filter is, so
+ * that the output can still be cut into frames by split.pl.
+ *
+ * Frame ranges and block summaries of the index (built by trace_to_txt -i,
+ * or here on the first query) let most of the trace be skipped. Archives
+ * made by trace_archive carry their own index and are queried directly,
+ * only the blocks that may match get decompressed.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "trace_arc.h"
+#include "trace_index.h"
+
+#define ADDR_RANGES_MAX		16
+
+struct addr_range {
+	uint32_t start;
+	uint32_t end;
+};
+
+struct filter {
+	uint32_t src_mask;
+	uint32_t types_mask;
+	uint32_t blocks_mask;
+	struct addr_range addr[ADDR_RANGES_MAX];
+	unsigned addr_nb;
+	uint32_t value;
+	uint32_t value_mask;
+	uint64_t frame_first;
+	uint64_t frame_last;
+	int by_frame;
+};
+
+static struct filter flt = {
+	.src_mask	= ~0u,
+	.types_mask	= ~0u,
+	.blocks_mask	= ~0u,
+};
+
+/* Pending run of the matching memory writes */
+struct run {
+	struct trace_seq seq;
+	uint64_t first;
+	uint64_t next;
+};
+
+static uint32_t raw_types_mask;
+static int print_idx;
+static int count_only;
+static int keep_markers;
+
+static void bad_term(const char *term)
+{
+	fprintf(stderr, "Bad filter term '%s'\n", term);
+	exit(EXIT_FAILURE);
+}
+
+static uint32_t parse_u32(const char *str, const char *term)
+{
+	char *end;
+	unsigned long long val = strtoull(str, &end, 0);
+
+	if (end == str || *end != '\0' || val > UINT32_MAX) {
+		bad_term(term);
+	}
+
+	return val;
+}
+
+static int type_by_name(const char *name)
+{
+	int type;
+
+	for (type = 0; type < TRACE_TYPES_NB; type++) {
+		if (strcasecmp(name, trace_type_name(type)) == 0) {
+			return type;
+		}
+	}
+
+	return -1;
+}
+
+static void parse_list(char *list, const char *term,
+		       void (*add)(char *item, const char *term))
+{
+	char *item, *saveptr;
+
+	for (item = strtok_r(list, ",", &saveptr); item != NULL;
+	     item = strtok_r(NULL, ",", &saveptr)) {
+		add(item, term);
+	}
+}
+
+static void add_src(char *item, const char *term)
+{
+	if (strcasecmp(item, "cpu") == 0 || strcasecmp(item, "ON_CPU") == 0) {
+		flt.src_mask |= 1u << TRACE_ON_CPU;
+	} else if (strcasecmp(item, "avp") == 0 ||
+		   strcasecmp(item, "ON_AVP") == 0) {
+		flt.src_mask |= 1u << TRACE_ON_AVP;
+	} else {
+		bad_term(term);
+	}
+}
+
+static void add_type(char *item, const char *term)
+{
+	int type = type_by_name(item);
+
+	if (type < 0) {
+		bad_term(term);
+	}
+
+	flt.types_mask |= 1u << type;
+}
+
+static void add_engine(char *item, const char *term)
+{
+	int block = trace_block_by_name(item);
+
+	if (block < 0) {
+		bad_term(term);
+	}
+
+	flt.blocks_mask |= 1u << block;
+}
+
+static void add_addr(char *item, const char *term)
+{
+	char *end = strchr(item, '-');
+	struct addr_range *range;
+
+	if (flt.addr_nb == ADDR_RANGES_MAX) {
+		bad_term(term);
+	}
+
+	range = &flt.addr[flt.addr_nb++];
+
+	if (end != NULL) {
+		*end++ = '\0';
+		range->start = parse_u32(item, term);
+		range->end = parse_u32(end, term);
+	} else {
+		range->start = range->end = parse_u32(item, term);
+	}
+
+	if (range->start > range->end) {
+		bad_term(term);
+	}
+}
+
+static void parse_term(char *term)
+{
+	char *copy = strdup(term);
+	char *val = strchr(copy, '=');
+	char *sep;
+
+	assert(copy != NULL);
+
+	if (val == NULL) {
+		bad_term(term);
+	}
+
+	*val++ = '\0';
+
+	if (strcmp(copy, "src") == 0) {
+		flt.src_mask = 0;
+		parse_list(val, term, add_src);
+	} else if (strcmp(copy, "type") == 0) {
+		flt.types_mask = 0;
+		parse_list(val, term, add_type);
+	} else if (strcmp(copy, "engine") == 0) {
+		flt.blocks_mask = 0;
+		parse_list(val, term, add_engine);
+	} else if (strcmp(copy, "addr") == 0) {
+		parse_list(val, term, add_addr);
+	} else if (strcmp(copy, "value") == 0) {
+		sep = strchr(val, '/');
+		if (sep != NULL) {
+			*sep++ = '\0';
+			flt.value_mask = parse_u32(sep, term);
+		} else {
+			flt.value_mask = ~0u;
+		}
+		flt.value = parse_u32(val, term) & flt.value_mask;
+	} else if (strcmp(copy, "frame") == 0) {
+		sep = strchr(val, '-');
+		if (sep != NULL) {
+			*sep++ = '\0';
+			flt.frame_last = parse_u32(sep, term);
+		}
+		flt.frame_first = parse_u32(val, term);
+		if (sep == NULL) {
+			flt.frame_last = flt.frame_first;
+		}
+		if (flt.frame_first > flt.frame_last) {
+			bad_term(term);
+		}
+		flt.by_frame = 1;
+	} else {
+		bad_term(term);
+	}
+
+	free(copy);
+}
+
+static void parse_filter(int argc, char **argv)
+{
+	char *copy, *term, *saveptr;
+	int i;
+
+	for (i = 0; i < argc; i++) {
+		copy = strdup(argv[i]);
+		assert(copy != NULL);
+
+		for (term = strtok_r(copy, " \t", &saveptr); term != NULL;
+		     term = strtok_r(NULL, " \t", &saveptr)) {
+			parse_term(term);
+		}
+
+		free(copy);
+	}
+}
+
+static int addr_match(uint32_t min, uint32_t max)
+{
+	unsigned i;
+
+	if (flt.addr_nb == 0) {
+		return 1;
+	}
+
+	for (i = 0; i < flt.addr_nb; i++) {
+		if (flt.addr[i].start <= max && flt.addr[i].end >= min) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int block_may_have_marker(const struct trace_index_block *blk)
+{
+	if (blk->types_mask & (1u << TRACE_IRQ)) {
+		return 1;
+	}
+
+	return (blk->addr_min <= TRACE_FRAME_RESET_ADDR &&
+		blk->addr_max >= TRACE_FRAME_RESET_ADDR) ||
+	       (blk->addr_min <= TRACE_FRAME_TRIM_ADDR &&
+		blk->addr_max >= TRACE_FRAME_TRIM_ADDR);
+}
+
+static int block_may_match(const struct trace_index_block *blk)
+{
+	if (keep_markers && block_may_have_marker(blk)) {
+		return 1;
+	}
+
+	return (blk->src_mask & flt.src_mask) &&
+	       (blk->types_mask & raw_types_mask) &&
+	       (blk->blocks_mask & flt.blocks_mask) &&
+	       addr_match(blk->addr_min, blk->addr_max);
+}
+
+/* Runs are matched by their records, the type is checked once merged */
+static int record_match(const struct trace_record *rec)
+{
+	return (flt.src_mask & (1u << rec->src)) &&
+	       (raw_types_mask & (1u << rec->type)) &&
+	       (flt.blocks_mask & (1u << trace_record_block(rec))) &&
+	       (rec->value & flt.value_mask) == flt.value &&
+	       addr_match(rec->addr, rec->addr);
+}
+
+/* Records come either from the raw trace or from the columnar archive */
+struct source {
+	const struct trace_file *trace;
+	const struct trace_arc *arc;
+	struct trace_record recs[TRACE_INDEX_BLOCK_RECORDS];
+	uint64_t loaded;
+	int nb;
+};
+
+static int load_block(struct source *src, uint64_t blk)
+{
+	uint64_t first = blk * TRACE_INDEX_BLOCK_RECORDS;
+	uint64_t i;
+
+	if (src->nb >= 0 && src->loaded == blk) {
+		return 0;
+	}
+
+	if (src->arc != NULL) {
+		src->nb = trace_arc_decode(src->arc, blk, src->recs, NULL);
+		if (src->nb < 0) {
+			fprintf(stderr, "Archive block %" PRIu64 " is corrupted\n",
+				blk);
+			return -1;
+		}
+	} else {
+		for (i = first; i < src->trace->records_nb &&
+				i < first + TRACE_INDEX_BLOCK_RECORDS; i++) {
+			trace_get_record(src->trace, i, &src->recs[i - first]);
+		}
+		src->nb = i - first;
+	}
+
+	src->loaded = blk;
+
+	return 0;
+}
+
+static void print_line(uint64_t idx, const struct trace_record *rec,
+		       const struct trace_seq *seq)
+{
+	char line[TRACE_LINE_MAX + 32];
+	int len = 0, ret;
+
+	if (print_idx) {
+		len = sprintf(line, "%" PRIu64 ": ", idx);
+	}
+
+	if (seq != NULL) {
+		ret = trace_format_seq(line + len, seq);
+	} else {
+		ret = trace_format_record(line + len, rec, 0);
+	}
+
+	if (ret < 0) {
+		fprintf(stderr, "Bad IRQ number %u in record %" PRIu64 "\n",
+			seq != NULL ? seq->addr : rec->addr, idx);
+		exit(EXIT_FAILURE);
+	}
+
+	fwrite(line, 1, len + ret, stdout);
+}
+
+static uint64_t flush_run(struct run *run)
+{
+	uint32_t type = run->seq.count > 1 ? TRACE_MEMSET32 : TRACE_WRITE32;
+	uint64_t count = run->seq.count;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	if (!(flt.types_mask & (1u << type))) {
+		run->seq.count = 0;
+		return 0;
+	}
+
+	if (!count_only) {
+		print_line(run->first, NULL, &run->seq);
+	}
+
+	run->seq.count = 0;
+
+	return count;
+}
+
+static uint64_t query_range(struct source *src, const struct trace_index *idx,
+			    uint64_t first, uint64_t end)
+{
+	const struct trace_record *rec;
+	struct run run = { .seq.count = 0 };
+	uint64_t matches = 0;
+	uint64_t blk, blk_first, blk_end;
+	uint64_t i = first;
+	int match;
+
+	while (i < end) {
+		blk = i / TRACE_INDEX_BLOCK_RECORDS;
+		blk_first = blk * TRACE_INDEX_BLOCK_RECORDS;
+		blk_end = blk_first + TRACE_INDEX_BLOCK_RECORDS;
+		if (blk_end > end) {
+			blk_end = end;
+		}
+
+		if (!block_may_match(&idx->blocks[blk])) {
+			i = blk_end;
+			continue;
+		}
+
+		if (load_block(src, blk) != 0) {
+			exit(EXIT_FAILURE);
+		}
+
+		for (; i < blk_end; i++) {
+			rec = &src->recs[i - blk_first];
+
+			if (rec->type >= TRACE_TYPES_NB) {
+				continue;
+			}
+
+			match = record_match(rec);
+
+			if (!match && !(keep_markers && trace_frame_marker(rec))) {
+				continue;
+			}
+
+			/* Only the adjacent records are merged, as in the log */
+			if (match && trace_seq_mergeable(rec)) {
+				if (run.next == i &&
+				    trace_seq_continues(&run.seq, rec)) {
+					run.seq.count++;
+					run.next++;
+					continue;
+				}
+
+				matches += flush_run(&run);
+				trace_seq_start(&run.seq, rec);
+				run.first = i;
+				run.next = i + 1;
+				continue;
+			}
+
+			matches += flush_run(&run);
+			matches += match;
+
+			if (!count_only) {
+				print_line(i, rec, NULL);
+			}
+		}
+	}
+
+	matches += flush_run(&run);
+
+	return matches;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-i index_path] [-n] [-c] [-m] trace.bin|archive "
+		"'filter terms'\n"
+		"\t-i index path (default trace.bin.idx), built if missing,\n"
+		"\t   archives carry their own index\n"
+		"\t-n prefix records with their index\n"
+		"\t-c only count matching records\n"
+		"\t-m keep the frame marker records for split.pl\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	char default_index_path[4096];
+	const char *index_path = NULL;
+	static struct source src;
+	struct trace_file trace;
+	struct trace_index idx;
+	struct trace_arc arc;
+	uint64_t records_nb;
+	uint64_t matches = 0;
+	uint64_t f;
+	int c;
+
+	while ((c = getopt(argc, argv, "i:ncm")) != -1) {
+		switch (c) {
+		case 'i':
+			index_path = optarg;
+			break;
+		case 'n':
+			print_idx = 1;
+			break;
+		case 'c':
+			count_only = 1;
+			break;
+		case 'm':
+			keep_markers = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+	}
+
+	parse_filter(argc - optind - 1, argv + optind + 1);
+
+	/* MEMSET32 runs are made of the WRITE32 records */
+	raw_types_mask = flt.types_mask;
+
+	if (flt.types_mask & (1u << TRACE_MEMSET32)) {
+		raw_types_mask |= 1u << TRACE_WRITE32;
+	}
+
+	src.nb = -1;
+
+	if (trace_arc_probe(argv[optind])) {
+		if (trace_arc_open(&arc, argv[optind]) != 0) {
+			exit(EXIT_FAILURE);
+		}
+
+		src.arc = &arc;
+		idx = arc.index;
+		records_nb = idx.records_nb;
+		goto query;
+	}
+
+	if (trace_open(&trace, argv[optind]) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	src.trace = &trace;
+	records_nb = trace.records_nb;
+
+	if (index_path == NULL) {
+		snprintf(default_index_path, sizeof(default_index_path),
+			 "%s.idx", argv[optind]);
+		index_path = default_index_path;
+	}
+
+	if (trace_index_read(&idx, &trace, index_path) != 0) {
+		trace_index_build(&idx, &trace);
+
+		/* Index is only a cache, query works without it */
+		trace_index_write(&idx, index_path);
+	}
+query:
+	if (flt.by_frame) {
+		for (f = flt.frame_first; f <= flt.frame_last &&
+					  f < idx.frames_nb; f++) {
+			matches += query_range(&src, &idx,
+					       idx.frames[f].first,
+					       idx.frames[f].end);
+		}
+	} else {
+		matches = query_range(&src, &idx, 0, records_nb);
+	}
+
+	if (count_only) {
+		printf("%" PRIu64 "\n", matches);
+	}
+
+	if (src.arc != NULL) {
+		trace_arc_close(&arc);
+	} else {
+		trace_index_free(&idx);
+		trace_close(&trace);
+	}
+
+	return 0;
+}
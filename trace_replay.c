@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Plays a saved IO trace into a FIFO or a Unix socket, standing in for the
+ * trace viewer recording to test trace_live without the hardware.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "trace.h"
+
+#define CHUNK_RECORDS	4096
+
+static int open_target(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd, sfd;
+
+	if (strncmp(path, "unix:", 5) != 0) {
+		if (mkfifo(path, 0644) != 0 && errno != EEXIST) {
+			perror(path);
+			return -1;
+		}
+
+		fd = open(path, O_WRONLY);
+		if (fd < 0) {
+			perror(path);
+		}
+		return fd;
+	}
+
+	if (strlen(path + 5) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: Socket path is too long\n", path);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path + 5);
+	unlink(addr.sun_path);
+
+	sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sfd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (bind(sfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(sfd, 1) != 0) {
+		perror(path);
+		close(sfd);
+		return -1;
+	}
+
+	/* Single consumer, like the trace viewer recording */
+	fd = accept(sfd, NULL, NULL);
+	if (fd < 0) {
+		perror(path);
+	}
+
+	close(sfd);
+	unlink(addr.sun_path);
+
+	return fd;
+}
+
+static int write_all(int fd, const uint8_t *data, size_t size)
+{
+	ssize_t ret;
+
+	while (size != 0) {
+		ret = write(fd, data, size);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (ret < 0) {
+			return -1;
+		}
+
+		data += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-r records_per_sec] trace.bin "
+		"fifo|unix:socket\n"
+		"\t-r throttle to the given rate (default as fast as possible)\n"
+		"FIFO is created if missing, socket is listened on.\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_file trace;
+	double rate = 0, start;
+	uint64_t i, nb;
+	int fd;
+	int c;
+
+	while ((c = getopt(argc, argv, "r:")) != -1) {
+		switch (c) {
+		case 'r':
+			rate = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 2) {
+		usage(argv[0]);
+	}
+
+	if (trace_open(&trace, argv[optind]) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	fd = open_target(argv[optind + 1]);
+	if (fd < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (write_all(fd, trace.data, TRACE_HEADER_SIZE) != 0) {
+		goto err;
+	}
+
+	start = now();
+
+	for (i = 0; i < trace.records_nb; i += nb) {
+		nb = trace.records_nb - i;
+
+		if (nb > CHUNK_RECORDS) {
+			nb = CHUNK_RECORDS;
+		}
+
+		if (rate > 0) {
+			double ahead = i / rate - (now() - start);
+
+			if (ahead > 0) {
+				usleep(ahead * 1e6);
+			}
+		}
+
+		if (write_all(fd, trace.data + TRACE_HEADER_SIZE +
+			      i * TRACE_RECORD_SIZE,
+			      nb * TRACE_RECORD_SIZE) != 0) {
+			goto err;
+		}
+	}
+
+	close(fd);
+	trace_close(&trace);
+
+	return 0;
+err:
+	perror(argv[optind + 1]);
+	close(fd);
+	trace_close(&trace);
+
+	return EXIT_FAILURE;
+}
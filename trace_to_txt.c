@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2016 Dmitry Osipenko <digetx@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *  for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Multi-threaded equivalent of bin_to_txt.pl.
+ *
+ * The trace is cut into fixed-size chunks that are converted independently.
+ * The only state crossing a record boundary is the MEMSET32 run, so every
+ * chunk keeps its leading run (which may continue the previous chunk) and
+ * its trailing run (which may continue into the next one) unformatted, and
+ * the writer thread stitches them in order.
+ *
+ * A record makes at most one line, so the text of a chunk never exceeds
+ * chunk_records * TRACE_LINE_MAX bytes. The chunks converted ahead of the
+ * writer are limited to TEXT_BUDGET bytes of such text (and to twice the
+ * threads number), which bounds the memory use whatever the trace size
+ * and the threads number are: about 64 MiB with the default chunks.
+ *
+ * Optionally the query index is built along the way: block summaries are
+ * filled by the workers (chunks are block-aligned), frame markers are
+ * collected per chunk and replayed in order by the writer.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "trace_index.h"
+
+#define CHUNK_RECORDS	(1 << 14)
+#define TEXT_BUDGET	(64 << 20)
+
+enum {
+	CHUNK_OK,
+	CHUNK_BAD_TYPE,
+	CHUNK_BAD_IRQ,
+};
+
+struct marker {
+	uint64_t idx;
+	struct trace_record rec;
+};
+
+struct chunk {
+	uint64_t first;
+	uint64_t last;
+	char *buf;
+	size_t len;
+	size_t size;
+	struct trace_seq head;
+	struct trace_seq tail;
+	int whole_run;		/* chunk is a part of a single run */
+	int error;
+	uint64_t error_rec;
+	uint32_t error_val;
+	struct marker *markers;
+	unsigned markers_nb;
+	unsigned markers_size;
+	int done;
+};
+
+static struct trace_file trace;
+static struct trace_index trace_idx;
+static int build_index;
+static uint64_t chunk_records = CHUNK_RECORDS;
+static struct chunk *slots;
+static unsigned slots_nb;
+static uint64_t chunks_nb;
+static uint64_t next_chunk;
+static uint64_t written_chunks;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static int chunk_put_seq(struct chunk *ch, const struct trace_seq *seq)
+{
+	if (seq->count == 0) {
+		return 0;
+	}
+
+	assert(ch->len + TRACE_LINE_MAX <= ch->size);
+	ch->len += trace_format_seq(ch->buf + ch->len, seq);
+
+	return 0;
+}
+
+static int chunk_put_record(struct chunk *ch, const struct trace_record *rec)
+{
+	int len;
+
+	assert(ch->len + TRACE_LINE_MAX <= ch->size);
+
+	len = trace_format_record(ch->buf + ch->len, rec, 0);
+	if (len < 0) {
+		return -1;
+	}
+
+	ch->len += len;
+
+	return 0;
+}
+
+static void chunk_add_marker(struct chunk *ch, uint64_t idx,
+			     const struct trace_record *rec)
+{
+	if (ch->markers_nb == ch->markers_size) {
+		ch->markers_size = ch->markers_size * 2 + 16;
+		ch->markers = realloc(ch->markers,
+				      ch->markers_size * sizeof(*ch->markers));
+		assert(ch->markers != NULL);
+	}
+
+	ch->markers[ch->markers_nb].idx = idx;
+	ch->markers[ch->markers_nb].rec = *rec;
+	ch->markers_nb++;
+}
+
+static void chunk_fail(struct chunk *ch, int error, uint64_t idx,
+		       uint32_t val)
+{
+	ch->error = error;
+	ch->error_rec = idx;
+	ch->error_val = val;
+}
+
+static void convert_chunk(struct chunk *ch)
+{
+	struct trace_seq seq = { 0 };
+	struct trace_record rec;
+	int in_head = 1;
+	uint64_t i;
+
+	ch->len = 0;
+	ch->error = CHUNK_OK;
+	ch->head.count = 0;
+	ch->tail.count = 0;
+	ch->markers_nb = 0;
+
+	for (i = ch->first; i < ch->last; i++) {
+		trace_get_record(&trace, i, &rec);
+
+		if (rec.type >= TRACE_TYPES_NB) {
+			chunk_fail(ch, CHUNK_BAD_TYPE, i, rec.type);
+			return;
+		}
+
+		if (build_index) {
+			trace_index_account(&trace_idx, i, &rec);
+
+			if (trace_frame_marker(&rec)) {
+				chunk_add_marker(ch, i, &rec);
+			}
+		}
+
+		if (in_head) {
+			if (ch->head.count == 0 && trace_seq_mergeable(&rec)) {
+				trace_seq_start(&ch->head, &rec);
+				continue;
+			}
+
+			if (trace_seq_continues(&ch->head, &rec)) {
+				ch->head.count++;
+				continue;
+			}
+
+			in_head = 0;
+		}
+
+		if (trace_seq_mergeable(&rec)) {
+			if (trace_seq_continues(&seq, &rec)) {
+				seq.count++;
+				continue;
+			}
+
+			chunk_put_seq(ch, &seq);
+			trace_seq_start(&seq, &rec);
+			continue;
+		}
+
+		chunk_put_seq(ch, &seq);
+		seq.count = 0;
+
+		if (chunk_put_record(ch, &rec) != 0) {
+			chunk_fail(ch, CHUNK_BAD_IRQ, i, rec.addr);
+			return;
+		}
+	}
+
+	ch->whole_run = in_head;
+	ch->tail = seq;
+}
+
+static void * worker(void *arg)
+{
+	struct chunk *ch;
+	uint64_t n;
+
+	(void)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+
+		while (next_chunk < chunks_nb &&
+		       next_chunk >= written_chunks + slots_nb) {
+			pthread_cond_wait(&cond, &lock);
+		}
+
+		if (next_chunk == chunks_nb) {
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+
+		n = next_chunk++;
+		ch = &slots[n % slots_nb];
+		ch->done = 0;
+
+		pthread_mutex_unlock(&lock);
+
+		ch->first = n * chunk_records;
+		ch->last = ch->first + chunk_records;
+
+		if (ch->last > trace.records_nb) {
+			ch->last = trace.records_nb;
+		}
+
+		convert_chunk(ch);
+
+		pthread_mutex_lock(&lock);
+		ch->done = 1;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+static void write_seq(FILE *fp, const struct trace_seq *seq)
+{
+	char line[TRACE_LINE_MAX];
+
+	if (seq->count == 0) {
+		return;
+	}
+
+	fwrite(line, 1, trace_format_seq(line, seq), fp);
+}
+
+static int write_chunk(FILE *fp, struct chunk *ch, struct trace_seq *carry)
+{
+	struct trace_record head_rec;
+	unsigned i;
+
+	if (ch->error != CHUNK_OK) {
+		if (ch->error == CHUNK_BAD_TYPE) {
+			fprintf(stderr, "Wrong record type %u\n", ch->error_val);
+		} else {
+			fprintf(stderr, "Bad IRQ number %u\n", ch->error_val);
+		}
+		return -1;
+	}
+
+	if (ch->head.count) {
+		head_rec.type  = TRACE_WRITE32;
+		head_rec.addr  = ch->head.addr;
+		head_rec.value = ch->head.value;
+		head_rec.src   = ch->head.src;
+
+		if (trace_seq_continues(carry, &head_rec)) {
+			carry->count += ch->head.count;
+		} else {
+			write_seq(fp, carry);
+			*carry = ch->head;
+		}
+	}
+
+	if (!ch->whole_run) {
+		write_seq(fp, carry);
+		fwrite(ch->buf, 1, ch->len, fp);
+		*carry = ch->tail;
+	}
+
+	for (i = 0; build_index && i < ch->markers_nb; i++) {
+		trace_index_frame_update(&trace_idx, ch->markers[i].idx,
+					 &ch->markers[i].rec);
+	}
+
+	return ferror(fp) ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-j threads] [-c chunk_records] "
+		"[-i index_path] trace.bin out.txt\n"
+		"\t-c records per chunk (default %u), the chunks in flight\n"
+		"\t   hold at most %u MiB of text\n", prog, CHUNK_RECORDS,
+		TEXT_BUDGET >> 20);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_seq carry = { 0 };
+	const char *index_path = NULL;
+	const char *out_path;
+	pthread_t *threads;
+	long threads_nb;
+	uint64_t n;
+	FILE *fp;
+	int err = 0;
+	int c, i;
+
+	threads_nb = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt(argc, argv, "j:c:i:")) != -1) {
+		switch (c) {
+		case 'j':
+			threads_nb = atoi(optarg);
+			break;
+		case 'c':
+			chunk_records = strtoull(optarg, NULL, 0);
+			break;
+		case 'i':
+			index_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 2) {
+		usage(argv[0]);
+	}
+
+	if (threads_nb < 1) {
+		threads_nb = 1;
+	}
+
+	if (chunk_records < 1) {
+		chunk_records = 1;
+	}
+
+	if (trace_open(&trace, argv[optind]) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	out_path = argv[optind + 1];
+
+	if (chunk_records > trace.records_nb && trace.records_nb != 0) {
+		chunk_records = trace.records_nb;
+	}
+
+	if (index_path != NULL) {
+		chunk_records += TRACE_INDEX_BLOCK_RECORDS - 1;
+		chunk_records -= chunk_records % TRACE_INDEX_BLOCK_RECORDS;
+
+		trace_index_init(&trace_idx, &trace);
+		build_index = 1;
+	}
+
+	fp = fopen(out_path, "w");
+	if (fp == NULL) {
+		perror(out_path);
+		exit(EXIT_FAILURE);
+	}
+
+	chunks_nb = (trace.records_nb + chunk_records - 1) / chunk_records;
+	slots_nb = TEXT_BUDGET / (chunk_records * TRACE_LINE_MAX);
+
+	if (slots_nb > threads_nb * 2) {
+		slots_nb = threads_nb * 2;
+	}
+
+	if (slots_nb < 1) {
+		slots_nb = 1;
+	}
+
+	slots = calloc(slots_nb, sizeof(*slots));
+	threads = calloc(threads_nb, sizeof(*threads));
+	assert(slots != NULL && threads != NULL);
+
+	/* Only the pages the text gets written to are actually used */
+	for (i = 0; i < (int)slots_nb; i++) {
+		slots[i].size = chunk_records * TRACE_LINE_MAX;
+		slots[i].buf = malloc(slots[i].size);
+		assert(slots[i].buf != NULL);
+	}
+
+	for (i = 0; i < threads_nb; i++) {
+		err = pthread_create(&threads[i], NULL, worker, NULL);
+		assert(err == 0);
+	}
+
+	for (n = 0; n < chunks_nb && !err; n++) {
+		struct chunk *ch = &slots[n % slots_nb];
+
+		pthread_mutex_lock(&lock);
+		while (!ch->done) {
+			pthread_cond_wait(&cond, &lock);
+		}
+		pthread_mutex_unlock(&lock);
+
+		err = write_chunk(fp, ch, &carry);
+
+		pthread_mutex_lock(&lock);
+		ch->done = 0;
+		written_chunks++;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+
+	/*
+	 * bin_to_txt.pl never flushes the run pending at the end of the
+	 * trace, the output is kept identical to it.
+	 */
+
+	if (err) {
+		/* Let workers finish, nothing is going to be written */
+		pthread_mutex_lock(&lock);
+		next_chunk = chunks_nb;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+
+	for (i = 0; i < threads_nb; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	if (fclose(fp) != 0) {
+		perror(out_path);
+		err = 1;
+	}
+
+	if (err) {
+		unlink(out_path);
+	}
+
+	if (build_index) {
+		if (!err && trace_index_write(&trace_idx, index_path) != 0) {
+			err = 1;
+		}
+
+		trace_index_free(&trace_idx);
+	}
+
+	for (i = 0; i < (int)slots_nb; i++) {
+		free(slots[i].markers);
+		free(slots[i].buf);
+	}
+
+	free(threads);
+	free(slots);
+	trace_close(&trace);
+
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}